@@ -0,0 +1,168 @@
+#ifndef AARECT_H
+#define AARECT_H
+
+#include "utils.h"
+#include "hittable.h"
+#include "material.h"
+
+//axis-aligned rectangles: one division for the intersection instead of a
+//quadratic, tight (slightly padded) bounding boxes, and uniform area
+//sampling so they can be used as lights
+
+class xy_rect : public hittable {
+public:
+	xy_rect() {}
+	xy_rect(double _x0, double _x1, double _y0, double _y1, double _k, shared_ptr<material> mat)
+		: x0(_x0), x1(_x1), y0(_y0), y1(_y1), k(_k), mp(mat) {};
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		output_box = aabb(point3(x0, y0, k - 0.0001), point3(x1, y1, k + 0.0001));
+		return true;
+	}
+
+	virtual int max_light_group() const override {
+		return mp ? mp->light_group() : -1;
+	}
+
+	virtual double pdf_value(const point3& o, const vec3& v) const override;
+	virtual vec3 random(const point3& o) const override {
+		return point3(random_double(x0, x1), random_double(y0, y1), k) - o;
+	}
+
+public:
+	double x0, x1, y0, y1, k;
+	shared_ptr<material> mp;
+};
+
+class xz_rect : public hittable {
+public:
+	xz_rect() {}
+	xz_rect(double _x0, double _x1, double _z0, double _z1, double _k, shared_ptr<material> mat)
+		: x0(_x0), x1(_x1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		output_box = aabb(point3(x0, k - 0.0001, z0), point3(x1, k + 0.0001, z1));
+		return true;
+	}
+
+	virtual int max_light_group() const override {
+		return mp ? mp->light_group() : -1;
+	}
+
+	virtual double pdf_value(const point3& o, const vec3& v) const override;
+	virtual vec3 random(const point3& o) const override {
+		return point3(random_double(x0, x1), k, random_double(z0, z1)) - o;
+	}
+
+public:
+	double x0, x1, z0, z1, k;
+	shared_ptr<material> mp;
+};
+
+class yz_rect : public hittable {
+public:
+	yz_rect() {}
+	yz_rect(double _y0, double _y1, double _z0, double _z1, double _k, shared_ptr<material> mat)
+		: y0(_y0), y1(_y1), z0(_z0), z1(_z1), k(_k), mp(mat) {};
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		output_box = aabb(point3(k - 0.0001, y0, z0), point3(k + 0.0001, y1, z1));
+		return true;
+	}
+
+	virtual int max_light_group() const override {
+		return mp ? mp->light_group() : -1;
+	}
+
+	virtual double pdf_value(const point3& o, const vec3& v) const override;
+	virtual vec3 random(const point3& o) const override {
+		return point3(k, random_double(y0, y1), random_double(z0, z1)) - o;
+	}
+
+public:
+	double y0, y1, z0, z1, k;
+	shared_ptr<material> mp;
+};
+
+//solid angle pdf of uniformly sampling a planar area light seen from o
+inline double area_light_pdf(const hittable& light, double area, const point3& o, const vec3& v) {
+	hit_record rec;
+	if (!light.hit(ray(o, v), 0.001, infty, rec))
+		return 0;
+
+	auto distance_squared = rec.t * rec.t * v.length_squared();
+	auto cosine = fabs(dot(v, rec.normal) / v.length());
+
+	return distance_squared / (cosine * area);
+}
+
+bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+	auto t = (k - r.origin().z()) / r.direction().z();
+	if (t < t_min || t > t_max)
+		return false;
+	auto x = r.origin().x() + t * r.direction().x();
+	auto y = r.origin().y() + t * r.direction().y();
+	if (x < x0 || x > x1 || y < y0 || y > y1)
+		return false;
+	rec.u = (x - x0) / (x1 - x0);
+	rec.v = (y - y0) / (y1 - y0);
+	rec.t = t;
+	rec.set_face_normal(r, vec3(0, 0, 1));
+	rec.mat_ptr = mp;
+	rec.p = r.at(t);
+	return true;
+}
+
+bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+	auto t = (k - r.origin().y()) / r.direction().y();
+	if (t < t_min || t > t_max)
+		return false;
+	auto x = r.origin().x() + t * r.direction().x();
+	auto z = r.origin().z() + t * r.direction().z();
+	if (x < x0 || x > x1 || z < z0 || z > z1)
+		return false;
+	rec.u = (x - x0) / (x1 - x0);
+	rec.v = (z - z0) / (z1 - z0);
+	rec.t = t;
+	rec.set_face_normal(r, vec3(0, 1, 0));
+	rec.mat_ptr = mp;
+	rec.p = r.at(t);
+	return true;
+}
+
+bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+	auto t = (k - r.origin().x()) / r.direction().x();
+	if (t < t_min || t > t_max)
+		return false;
+	auto y = r.origin().y() + t * r.direction().y();
+	auto z = r.origin().z() + t * r.direction().z();
+	if (y < y0 || y > y1 || z < z0 || z > z1)
+		return false;
+	rec.u = (y - y0) / (y1 - y0);
+	rec.v = (z - z0) / (z1 - z0);
+	rec.t = t;
+	rec.set_face_normal(r, vec3(1, 0, 0));
+	rec.mat_ptr = mp;
+	rec.p = r.at(t);
+	return true;
+}
+
+double xy_rect::pdf_value(const point3& o, const vec3& v) const {
+	return area_light_pdf(*this, (x1 - x0) * (y1 - y0), o, v);
+}
+
+double xz_rect::pdf_value(const point3& o, const vec3& v) const {
+	return area_light_pdf(*this, (x1 - x0) * (z1 - z0), o, v);
+}
+
+double yz_rect::pdf_value(const point3& o, const vec3& v) const {
+	return area_light_pdf(*this, (y1 - y0) * (z1 - z0), o, v);
+}
+
+#endif
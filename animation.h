@@ -0,0 +1,291 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+//keyframed sequences rendered in one process. The Cornell box, its
+//materials and the bvh are built once; every frame only moves the animated
+//objects, refits the bvh and sets up the camera, and the finished frame is
+//written on a separate thread while the next one renders.
+
+#include "render.h"
+#include "scenes.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct camera_key {
+	int frame;
+	point3 lookfrom;
+	point3 lookat;
+	double vfov;
+};
+
+struct offset_key {
+	int frame;
+	vec3 offset;
+};
+
+//position of frame between the keys around it: keys[k0], keys[k1] and the
+//blend factor t; frames outside the keyed range hold the first/last key
+template <typename key>
+void bracket_keys(const std::vector<key>& keys, int frame, size_t& k0, size_t& k1, double& t) {
+	k1 = 0;
+	while (k1 < keys.size() && keys[k1].frame < frame)
+		++k1;
+	if (k1 == 0 || k1 == keys.size()) {
+		k0 = k1 = std::min(k1, keys.size() - 1);
+		t = 0;
+		return;
+	}
+	k0 = k1 - 1;
+	t = static_cast<double>(frame - keys[k0].frame) / (keys[k1].frame - keys[k0].frame);
+}
+
+class sequence {
+public:
+	sequence() : frames(1) {}
+
+	camera camera_at(int frame, double asp_ratio) const {
+		size_t k0, k1;
+		double t;
+		bracket_keys(camera_keys, frame, k0, k1, t);
+		const auto& a = camera_keys[k0];
+		const auto& b = camera_keys[k1];
+		return camera((1 - t) * a.lookfrom + t * b.lookfrom, (1 - t) * a.lookat + t * b.lookat,
+			vec3(0, 1, 0), (1 - t) * a.vfov + t * b.vfov, asp_ratio);
+	}
+
+	vec3 offset_at(const std::vector<offset_key>& keys, int frame) const {
+		size_t k0, k1;
+		double t;
+		bracket_keys(keys, frame, k0, k1, t);
+		return (1 - t) * keys[k0].offset + t * keys[k1].offset;
+	}
+
+public:
+	int frames;
+	std::vector<camera_key> camera_keys;
+	std::map<std::string, std::vector<offset_key>> object_keys;
+};
+
+//  frames 48
+//  camera 0 lookfrom=50,50,295.6 lookat=50,50,50 vfov=30
+//  camera 47 lookfrom=70,55,280
+//  object light 0 offset=0,0,0
+//  object light 47 offset=-20,0,10
+//camera fields left out repeat the previous camera key (or the defaults);
+//'#' starts a comment. Objects have to be among object_names.
+bool read_sequence(
+	std::istream& in,
+	const camera_key& defaults,
+	const std::vector<std::string>& object_names,
+	sequence& seq
+) {
+	std::string line;
+	int line_no = 0;
+	while (std::getline(in, line)) {
+		++line_no;
+		auto hash = line.find('#');
+		if (hash != std::string::npos)
+			line.erase(hash);
+
+		std::istringstream tokens(line);
+		std::string kind;
+		if (!(tokens >> kind))
+			continue;
+
+		bool ok = true;
+		if (kind == "frames") {
+			ok = static_cast<bool>(tokens >> seq.frames) && seq.frames > 0;
+		}
+		else if (kind == "camera") {
+			camera_key key = seq.camera_keys.empty() ? defaults : seq.camera_keys.back();
+			ok = static_cast<bool>(tokens >> key.frame);
+			std::string token;
+			while (ok && tokens >> token) {
+				auto eq = token.find('=');
+				auto name = token.substr(0, eq);
+				auto value = eq == std::string::npos ? std::string() : token.substr(eq + 1);
+				if (name == "lookfrom")
+					ok = parse_vec3(value, key.lookfrom);
+				else if (name == "lookat")
+					ok = parse_vec3(value, key.lookat);
+				else if (name == "vfov")
+					ok = static_cast<bool>(std::istringstream(value) >> key.vfov) && key.vfov > 0 && key.vfov < 180;
+				else
+					ok = false;
+			}
+			seq.camera_keys.push_back(key);
+		}
+		else if (kind == "object") {
+			std::string name, token;
+			offset_key key = { 0, vec3(0, 0, 0) };
+			ok = static_cast<bool>(tokens >> name >> key.frame >> token)
+				&& token.compare(0, 7, "offset=") == 0 && parse_vec3(token.substr(7), key.offset);
+			if (ok && std::find(object_names.begin(), object_names.end(), name) == object_names.end()) {
+				std::cerr << "sequence line " << line_no << ": unknown object '" << name << "'\n";
+				return false;
+			}
+			seq.object_keys[name].push_back(key);
+		}
+		else {
+			ok = false;
+		}
+
+		if (!ok) {
+			std::cerr << "sequence line " << line_no << ": cannot parse '" << line << "'\n";
+			return false;
+		}
+	}
+
+	if (seq.camera_keys.empty())
+		seq.camera_keys.push_back(defaults);
+	auto by_frame = [](const auto& a, const auto& b) { return a.frame < b.frame; };
+	std::stable_sort(seq.camera_keys.begin(), seq.camera_keys.end(), by_frame);
+	for (auto& track : seq.object_keys)
+		std::stable_sort(track.second.begin(), track.second.end(), by_frame);
+	return true;
+}
+
+//simple_scene with the balls and the light wrapped in translate instances
+//named "glass", "metal" and "light"
+class animated_scene {
+public:
+	animated_scene(const point3& loc, double radius, const color& col) {
+		auto balls = cornell_balls();
+		instances["glass"] = make_shared<translate>(balls.objects[0], vec3(0, 0, 0));
+		instances["metal"] = make_shared<translate>(balls.objects[1], vec3(0, 0, 0));
+		instances["light"] = make_shared<translate>(
+			make_shared<sphere>(loc, radius, make_shared<diffuse_light>(col, 0)), vec3(0, 0, 0));
+
+		hittable_list objects = cornell_walls();
+		for (const auto& instance : instances)
+			objects.add(instance.second);
+		world = make_shared<bvh_node>(objects);
+		//light sampling ignores the material, so the moving light itself
+		//serves as the sampling target
+		lights = instances["light"];
+	}
+
+	std::vector<std::string> object_names() const {
+		std::vector<std::string> names;
+		for (const auto& instance : instances)
+			names.push_back(instance.first);
+		return names;
+	}
+
+	//move every animated object to the given frame; unknown names are ignored
+	void set_frame(const sequence& seq, int frame) {
+		for (const auto& track : seq.object_keys) {
+			auto found = instances.find(track.first);
+			if (found != instances.end() && !track.second.empty())
+				found->second->offset = seq.offset_at(track.second, frame);
+		}
+		world->refit();
+	}
+
+public:
+	shared_ptr<bvh_node> world;
+	shared_ptr<hittable> lights;
+	std::map<std::string, shared_ptr<translate>> instances;
+};
+
+//expands a frame pattern such as "frame_%04d.ppm": exactly one %d, %Nd or
+//%0Nd and otherwise only %% is allowed; false for any other pattern. The
+//name is built here rather than by printf, so the pattern can come from
+//the command line.
+bool frame_path(const std::string& pattern, int frame, std::string& path) {
+	path.clear();
+	bool have_number = false;
+	for (size_t k = 0; k < pattern.size(); ++k) {
+		if (pattern[k] != '%') {
+			path += pattern[k];
+			continue;
+		}
+		if (++k < pattern.size() && pattern[k] == '%') {
+			path += '%';
+			continue;
+		}
+		auto pad = ' ';
+		if (k < pattern.size() && pattern[k] == '0') {
+			pad = '0';
+			++k;
+		}
+		size_t width = 0;
+		while (k < pattern.size() && isdigit(static_cast<unsigned char>(pattern[k])) && width < 100)
+			width = 10 * width + (pattern[k++] - '0');
+		if (k >= pattern.size() || pattern[k] != 'd' || have_number || width >= 100)
+			return false;
+		have_number = true;
+
+		auto digits = std::to_string(frame);
+		if (digits.size() < width)
+			path.append(width - digits.size(), pad);
+		path += digits;
+	}
+	return have_number;
+}
+
+//frame_pattern has to be valid for frame_path
+void render_sequence(
+	const sequence& seq,
+	animated_scene& scene,
+	const render_settings& rs,
+	double asp_ratio,
+	int tile_size,
+	const std::string& frame_pattern,
+	thread_pool& pool
+) {
+	using clock = std::chrono::steady_clock;
+	auto tiles = make_tiles(rs.img_width, rs.img_height, tile_size);
+
+	//two buffers: one being written to disk while the other renders
+	framebuffer buffers[2];
+	std::future<bool> writing;
+	std::string writing_path;
+
+	for (auto f = 0; f < seq.frames; ++f) {
+		auto start = clock::now();
+		scene.set_frame(seq, f);
+		camera cam = seq.camera_at(f, asp_ratio);
+		auto& fb = buffers[f % 2];
+		fb = framebuffer(rs.img_width, rs.img_height);
+		std::chrono::duration<double, std::milli> setup = clock::now() - start;
+
+		const hittable& world = *scene.world;
+		for (const auto& t : tiles) {
+			pool.submit([&, t] {
+				std::vector<float> buffer(3 * t.pixels());
+				render_tile(t, 0, rs.samples_per_pixel, rs, cam, world, scene.lights, buffer.data());
+				fb.add_tile(t, buffer.data(), rs.samples_per_pixel);
+			});
+		}
+		pool.wait();
+		std::chrono::duration<double> elapsed = clock::now() - start;
+
+		if (writing.valid() && !writing.get())
+			std::cerr << "cannot write " << writing_path << '\n';
+
+		frame_path(frame_pattern, f, writing_path);
+		writing = std::async(std::launch::async, [&fb, writing_path] {
+			std::ofstream out(writing_path);
+			fb.write_ppm(out);
+			return static_cast<bool>(out);
+		});
+
+		std::cerr << "Frame " << f + 1 << " of " << seq.frames << ": setup " << setup.count()
+			<< " ms, render " << elapsed.count() << " s\n";
+	}
+
+	if (writing.valid() && !writing.get())
+		std::cerr << "cannot write " << writing_path << '\n';
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+//equal-time convergence benchmark: renders a fixed set of scenes with every
+//integrator/sampler configuration for the same wall-clock budgets and
+//measures the error against stored high-spp references. The scenes and
+//settings here are frozen on purpose so numbers stay comparable across
+//commits; do not tie them to the defaults in main() or to scenes.h. The
+//references in references/ were rendered from exactly this geometry, so
+//changing it means regenerating them with --make-references.
+
+#include "render.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "aarect.h"
+#include "bvh.h"
+#include "material.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+struct benchmark_scene {
+	std::string name;
+	hittable_list world;
+	shared_ptr<hittable> lights;
+	camera cam;
+};
+
+struct benchmark_config {
+	std::string integrator_name;
+	std::string sampler_name;
+	integrator_type integrator;
+	sampler_type sampler;
+};
+
+struct error_metrics {
+	double rmse;
+	double relmse;
+};
+
+const int bench_width = 160;
+const int bench_height = 90;
+const int bench_max_depth = 10;
+const unsigned int bench_reference_seed = 0x0c0ffeeu;
+
+//private copy of the Cornell box with a spherical light
+hittable_list benchmark_box(const point3& light_loc, double light_radius, const color& light_color) {
+	hittable_list objects;
+
+	auto red = make_shared<lambertian>(color(0.75, 0.25, 0.25));
+	auto blue = make_shared<lambertian>(color(0.25, 0.25, 0.75));
+	auto grey = make_shared<lambertian>(color(0.75, 0.75, 0.75));
+
+	const double x0 = 1, x1 = 99, y0 = 0, y1 = 81.6, z0 = 0, z1 = 1000;
+	objects.add(make_shared<yz_rect>(y0, y1, z0, z1, x0, red));
+	objects.add(make_shared<yz_rect>(y0, y1, z0, z1, x1, blue));
+	objects.add(make_shared<xy_rect>(x0, x1, y0, y1, z0, grey));
+	objects.add(make_shared<xz_rect>(x0, x1, z0, z1, y0, grey));
+	objects.add(make_shared<xz_rect>(x0, x1, z0, z1, y1, grey));
+
+	objects.add(make_shared<sphere>(point3(27, 16.5, 47), 16.5, make_shared<dielectric>(1.5)));
+	objects.add(make_shared<sphere>(point3(73, 16.5, 78), 16.5, make_shared<metal>(color(1, 1, 1), 0.2)));
+
+	objects.add(make_shared<sphere>(light_loc, light_radius, make_shared<diffuse_light>(light_color, 0)));
+	return hittable_list(make_shared<bvh_node>(objects));
+}
+
+std::vector<benchmark_scene> benchmark_scenes() {
+	const auto asp_ratio = static_cast<double>(bench_width) / bench_height;
+	camera cam(point3(50, 50, 295.6), point3(50, 50, 50), vec3(0, 1, 0), 30, asp_ratio);
+
+	std::vector<benchmark_scene> scenes;
+
+	//the box under a huge dim light sphere
+	const point3 loc(50, 681.6 - 0.27, 81.6);
+	scenes.push_back({ "simple_scene", benchmark_box(loc, 600, color(15, 15, 15)),
+		make_shared<sphere>(loc, 600, shared_ptr<material>()), cam });
+
+	//same box lit by a small bright sphere, where light sampling matters
+	const point3 small_loc(50, 70, 81.6);
+	scenes.push_back({ "small_light", benchmark_box(small_loc, 5, color(200, 200, 200)),
+		make_shared<sphere>(small_loc, 5, shared_ptr<material>()), cam });
+
+	return scenes;
+}
+
+std::vector<benchmark_config> benchmark_configs() {
+	return {
+		{ "bsdf", "random", integrator_type::bsdf, sampler_type::random },
+		{ "bsdf", "r2", integrator_type::bsdf, sampler_type::r2 },
+		{ "mixture", "random", integrator_type::mixture, sampler_type::random },
+		{ "mixture", "r2", integrator_type::mixture, sampler_type::r2 },
+	};
+}
+
+//rmse over all channels and relative mse (squared error over squared
+//reference, with a small offset for dark pixels) of the mean images
+error_metrics image_error(const framebuffer& img, const framebuffer& ref) {
+	auto se = 0.0;
+	auto rel = 0.0;
+	for (auto j = 0; j < img.height; ++j) {
+		for (auto i = 0; i < img.width; ++i) {
+			auto a = img.mean(i, j);
+			auto b = ref.mean(i, j);
+			for (auto c = 0; c < 3; ++c) {
+				auto d = a[c] - b[c];
+				se += d * d;
+				rel += d * d / (b[c] * b[c] + 0.01);
+			}
+		}
+	}
+	auto n = 3.0 * img.width * img.height;
+	return { sqrt(se / n), rel / n };
+}
+
+//render whole-image passes of one sample until each time budget is reached;
+//calls record(elapsed, spp, fb) once per budget
+template <typename callback>
+void render_for_budgets(
+	const benchmark_scene& scene,
+	const render_settings& rs,
+	const std::vector<double>& budgets,
+	thread_pool& pool,
+	callback record
+) {
+	auto tiles = make_tiles(rs.img_width, rs.img_height, 16);
+	framebuffer fb(rs.img_width, rs.img_height);
+	auto start = std::chrono::steady_clock::now();
+	size_t next = 0;
+	for (auto pass = 0; next < budgets.size(); ++pass) {
+		for (const auto& t : tiles) {
+			pool.submit([&, t, pass] {
+				std::vector<float> buffer(3 * t.pixels());
+				render_tile(t, pass, pass + 1, rs, scene.cam, scene.world, scene.lights, buffer.data());
+				fb.add_tile(t, buffer.data(), 1);
+			});
+		}
+		pool.wait();
+
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		while (next < budgets.size() && elapsed.count() >= budgets[next]) {
+			record(elapsed.count(), pass + 1, fb);
+			++next;
+		}
+	}
+}
+
+inline std::string reference_path(const std::string& dir, const benchmark_scene& scene) {
+	return dir + "/" + scene.name + ".pfm";
+}
+
+inline render_settings benchmark_settings(const benchmark_config& config, unsigned int seed) {
+	render_settings rs = { bench_width, bench_height, 1, bench_max_depth, color(0, 0, 0), seed, 0,
+		config.integrator, config.sampler };
+	return rs;
+}
+
+bool make_references(const std::string& dir, int spp, thread_pool& pool) {
+	auto config = benchmark_configs().back();
+	auto rs = benchmark_settings(config, bench_reference_seed);
+	rs.samples_per_pixel = spp;
+	auto tiles = make_tiles(rs.img_width, rs.img_height, 16);
+
+	for (const auto& scene : benchmark_scenes()) {
+		framebuffer fb(rs.img_width, rs.img_height);
+		for (const auto& t : tiles) {
+			pool.submit([&, t] {
+				std::vector<float> buffer(3 * t.pixels());
+				render_tile(t, 0, spp, rs, scene.cam, scene.world, scene.lights, buffer.data());
+				fb.add_tile(t, buffer.data(), spp);
+			});
+		}
+		pool.wait();
+
+		auto path = reference_path(dir, scene);
+		if (!fb.write_pfm(path)) {
+			std::cerr << "cannot write " << path << '\n';
+			return false;
+		}
+		std::cerr << "Wrote " << path << '\n';
+	}
+	return true;
+}
+
+//writes one CSV row per scene, configuration and budget; efficiency is
+//1 / (relMSE * time), higher is better
+bool run_benchmark(const std::string& dir, const std::vector<double>& budgets, std::ostream& csv, thread_pool& pool) {
+	csv << "scene,integrator,sampler,time_s,spp,rmse,relmse,efficiency\n";
+	csv << std::setprecision(6);
+
+	for (const auto& scene : benchmark_scenes()) {
+		framebuffer ref;
+		if (!ref.read_pfm(reference_path(dir, scene)) || ref.width != bench_width || ref.height != bench_height) {
+			std::cerr << "missing or mismatched reference " << reference_path(dir, scene)
+				<< ", create it with --make-references\n";
+			return false;
+		}
+
+		for (const auto& config : benchmark_configs()) {
+			auto rs = benchmark_settings(config, 0);
+			double last_efficiency = 0;
+			render_for_budgets(scene, rs, budgets, pool, [&](double elapsed, int spp, const framebuffer& fb) {
+				auto err = image_error(fb, ref);
+				last_efficiency = 1.0 / (err.relmse * elapsed);
+				csv << scene.name << ',' << config.integrator_name << ',' << config.sampler_name << ','
+					<< elapsed << ',' << spp << ',' << err.rmse << ',' << err.relmse << ','
+					<< last_efficiency << '\n';
+			});
+			std::cerr << std::left << std::setw(14) << scene.name << std::setw(9) << config.integrator_name
+				<< std::setw(8) << config.sampler_name << "efficiency " << last_efficiency << '\n';
+		}
+	}
+	return true;
+}
+
+#endif
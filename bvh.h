@@ -0,0 +1,117 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "utils.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <iostream>
+
+//bounding volume hierarchy over objects with bounding boxes; nodes split
+//at the median of the longest axis of the box around their centroids
+class bvh_node : public hittable {
+public:
+	bvh_node() {}
+	bvh_node(const hittable_list& list) {
+		auto objects = list.objects;
+		if (!objects.empty())
+			build(objects, 0, objects.size());
+	}
+
+	virtual bool hit(
+		const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		output_box = box;
+		return true;
+	}
+
+	//update the boxes bottom-up for moved objects, keeping the tree as built;
+	//much cheaper than a rebuild while the motion stays small
+	virtual void refit() override {
+		if (!left)
+			return;
+		left->refit();
+		if (right != left)
+			right->refit();
+
+		aabb box_left, box_right;
+		left->bounding_box(box_left);
+		right->bounding_box(box_right);
+		box = surrounding_box(box_left, box_right);
+	}
+
+	virtual int max_light_group() const override {
+		if (!left)
+			return -1;
+		return std::max(left->max_light_group(), right->max_light_group());
+	}
+
+public:
+	shared_ptr<hittable> left;
+	shared_ptr<hittable> right;
+	aabb box;
+
+private:
+	//reorders objects[start, end) in place while splitting
+	void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end);
+};
+
+inline point3 box_center(const shared_ptr<hittable>& h) {
+	aabb b;
+	if (!h->bounding_box(b))
+		std::cerr << "No bounding box in bvh_node constructor.\n";
+	return 0.5 * (b.min() + b.max());
+}
+
+void bvh_node::build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
+	size_t object_span = end - start;
+
+	if (object_span == 1) {
+		left = right = objects[start];
+	}
+	else if (object_span == 2) {
+		left = objects[start];
+		right = objects[start + 1];
+	}
+	else {
+		aabb centers(box_center(objects[start]), box_center(objects[start]));
+		for (auto i = start + 1; i < end; ++i) {
+			auto c = box_center(objects[i]);
+			centers = surrounding_box(centers, aabb(c, c));
+		}
+		int axis = centers.longest_axis();
+
+		auto mid = start + object_span / 2;
+		std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end,
+			[axis](const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
+				return box_center(a)[axis] < box_center(b)[axis];
+			});
+
+		auto left_node = make_shared<bvh_node>();
+		auto right_node = make_shared<bvh_node>();
+		left_node->build(objects, start, mid);
+		right_node->build(objects, mid, end);
+		left = left_node;
+		right = right_node;
+	}
+
+	aabb box_left, box_right;
+	if (!left->bounding_box(box_left) || !right->bounding_box(box_right))
+		std::cerr << "No bounding box in bvh_node constructor.\n";
+
+	box = surrounding_box(box_left, box_right);
+}
+
+bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+	if (!left || !box.hit(r, t_min, t_max))
+		return false;
+
+	bool hit_left = left->hit(r, t_min, t_max, rec);
+	bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+
+	return hit_left || hit_right;
+}
+
+#endif
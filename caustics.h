@@ -0,0 +1,326 @@
+#ifndef CAUSTICS_H
+#define CAUSTICS_H
+
+//caustics from a photon pass: light paths that reach a diffuse surface
+//through one or more specular bounces (L S+ D) are traced from the lights
+//and stored in a kd-tree, and camera paths estimate their radiance from
+//the photon density instead of having to hit the light through the glass.
+//Camera paths that do reach a light that way (D S+ L) carry no emission,
+//so every caustic is counted once. Each pass traces fresh photons with a
+//shrinking radius (progressive photon mapping), which keeps the average
+//over passes consistent.
+
+#include "utils.h"
+#include "hittable.h"
+#include "material.h"
+#include "camera.h"
+#include "render.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+struct photon {
+	float p[3];
+	float dir[3]; //direction of travel
+	float power[3];
+	int axis;     //split axis of the kd-tree node held by this photon
+};
+
+//balanced kd-tree stored implicitly in one array: the node of the range
+//[b, e) is the photon at its middle, its subtrees are the two halves
+class photon_map {
+public:
+	void build(std::vector<photon>&& stored) {
+		photons = std::move(stored);
+		build_range(0, photons.size());
+	}
+
+	size_t size() const {
+		return photons.size();
+	}
+
+	//calls f(photon, squared distance) for every photon within radius of x
+	template <typename callback>
+	void for_each_within(const point3& x, double radius, callback f) const {
+		const float q[3] = { static_cast<float>(x.x()), static_cast<float>(x.y()), static_cast<float>(x.z()) };
+		query(0, photons.size(), q, static_cast<float>(radius * radius), f);
+	}
+
+private:
+	void build_range(size_t b, size_t e) {
+		if (e <= b)
+			return;
+
+		const auto big = std::numeric_limits<float>::max();
+		float lo[3] = { big, big, big };
+		float hi[3] = { -big, -big, -big };
+		for (auto k = b; k < e; ++k) {
+			for (auto a = 0; a < 3; ++a) {
+				lo[a] = std::min(lo[a], photons[k].p[a]);
+				hi[a] = std::max(hi[a], photons[k].p[a]);
+			}
+		}
+		int axis = 0;
+		for (auto a = 1; a < 3; ++a) {
+			if (hi[a] - lo[a] > hi[axis] - lo[axis])
+				axis = a;
+		}
+
+		auto m = b + (e - b) / 2;
+		std::nth_element(photons.begin() + b, photons.begin() + m, photons.begin() + e,
+			[axis](const photon& a, const photon& c) { return a.p[axis] < c.p[axis]; });
+		photons[m].axis = axis;
+		build_range(b, m);
+		build_range(m + 1, e);
+	}
+
+	template <typename callback>
+	void query(size_t b, size_t e, const float q[3], float r2, callback& f) const {
+		if (e <= b)
+			return;
+
+		auto m = b + (e - b) / 2;
+		const auto& ph = photons[m];
+		auto dx = q[0] - ph.p[0], dy = q[1] - ph.p[1], dz = q[2] - ph.p[2];
+		auto d2 = dx * dx + dy * dy + dz * dz;
+		if (d2 <= r2)
+			f(ph, d2);
+
+		//the side holding q first, the other only if the sphere crosses the plane
+		auto d = q[ph.axis] - ph.p[ph.axis];
+		if (d < 0) {
+			query(b, m, q, r2, f);
+			if (d * d <= r2)
+				query(m + 1, e, q, r2, f);
+		}
+		else {
+			query(m + 1, e, q, r2, f);
+			if (d * d <= r2)
+				query(b, m, q, r2, f);
+		}
+	}
+
+private:
+	std::vector<photon> photons;
+};
+
+//traces count photon paths and appends the caustic photons to out; power
+//is normalized by total_paths, the number of paths of the whole pass.
+//Every caustic path starts with a bounce off a specular caster, so instead
+//of emitting blindly from the (possibly huge) light, a point on a caster
+//is picked and connected to the light with the light's direction sampling;
+//the photon then travels from that light point through the caster. The
+//casters have to include every specular object of the world.
+void trace_caustic_photons(
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	const hittable& casters,
+	int max_depth,
+	int count,
+	int total_paths,
+	std::vector<photon>& out
+) {
+	for (auto k = 0; k < count; ++k) {
+		point3 x;
+		vec3 nx;
+		double area;
+		if (!casters.sample_surface(x, nx, area))
+			continue;
+
+		auto to_light = unit_vector(lights->random(x));
+		auto cos_x = dot(to_light, nx);
+		if (cos_x <= 0)
+			continue;
+		auto pdf_val = lights->pdf_value(x, to_light);
+		if (pdf_val <= 0)
+			continue;
+
+		//the light must be the first thing seen from x
+		ray towards(x, to_light);
+		hit_record lrec;
+		if (!world.hit(towards, 0.001, infty, lrec))
+			continue;
+		color power = lrec.mat_ptr->emitted(towards, lrec, lrec.u, lrec.v, lrec.p);
+		if (power.near_zero())
+			continue;
+		power = power * (cos_x * area / (pdf_val * total_paths));
+
+		ray r(lrec.p, x - lrec.p);
+		bool specular = false;
+		for (auto depth = 0; depth < max_depth; ++depth) {
+			hit_record rec;
+			if (!world.hit(r, 0.001, infty, rec))
+				break;
+			scatter_record srec;
+			if (!rec.mat_ptr->scatter(r, rec, srec))
+				break;
+			if (!srec.is_specular) {
+				if (specular) {
+					auto d = unit_vector(r.direction());
+					photon ph;
+					for (auto a = 0; a < 3; ++a) {
+						ph.p[a] = static_cast<float>(rec.p[a]);
+						ph.dir[a] = static_cast<float>(d[a]);
+						ph.power[a] = static_cast<float>(power[a]);
+					}
+					ph.axis = 0;
+					out.push_back(ph);
+				}
+				break;
+			}
+			specular = true;
+			power = power * srec.attenuation;
+			r = srec.specular_ray;
+		}
+	}
+}
+
+//reflected caustic radiance at a diffuse hit: photons arriving on the
+//visible side within radius, times the lambertian brdf albedo / pi
+color caustic_radiance(const photon_map& map, const hit_record& rec, const color& albedo, double radius) {
+	color flux(0, 0, 0);
+	map.for_each_within(rec.p, radius, [&](const photon& ph, float) {
+		if (ph.dir[0] * rec.normal.x() + ph.dir[1] * rec.normal.y() + ph.dir[2] * rec.normal.z() < 0)
+			flux += color(ph.power[0], ph.power[1], ph.power[2]);
+	});
+	return albedo * flux / (PI * PI * radius * radius);
+}
+
+//ray_color with caustics from the photon map; after_diffuse is set once the
+//path has left a diffuse surface, through_specular once a specular bounce
+//followed it, which is when emission found here is the photon map's job
+color ray_color_caustics(
+	const ray& r,
+	const color& background,
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	int depth,
+	integrator_type integrator,
+	const photon_map& map,
+	double radius,
+	bool after_diffuse,
+	bool through_specular
+) {
+	hit_record rec;
+
+	if (depth <= 0)
+		return color(0, 0, 0);
+
+	if (!world.hit(r, 0.001, infty, rec))
+		return background;
+
+	scatter_record srec;
+	color emitted = through_specular ? color(0, 0, 0) : rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+
+	if (!rec.mat_ptr->scatter(r, rec, srec))
+		return emitted;
+
+	if (srec.is_specular) {
+		return srec.attenuation * ray_color_caustics(srec.specular_ray, background, world, lights, depth - 1,
+			integrator, map, radius, after_diffuse, after_diffuse);
+	}
+
+	color caustic = caustic_radiance(map, rec, srec.attenuation, radius);
+
+	ray scattered;
+	double pdf_val;
+	if (!sample_bounce(rec, lights, integrator, scattered, pdf_val))
+		return emitted + caustic;
+
+	return emitted + caustic + srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered)
+		* ray_color_caustics(scattered, background, world, lights, depth - 1, integrator, map, radius, true, false) / pdf_val;
+}
+
+void render_tile_caustics(
+	const tile& t,
+	int s0,
+	int s1,
+	const render_settings& rs,
+	const camera& cam,
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	const photon_map& map,
+	double radius,
+	float* out
+) {
+	render_tile_with(t, s0, s1, rs, cam, out, [&](const ray& r) {
+		return ray_color_caustics(r, rs.background, world, lights, rs.max_depth, rs.integrator, map, radius, false, false);
+	});
+}
+
+//one photon map and one sample per pixel per pass; the squared radius
+//shrinks as r2 * (i + alpha) / (i + 1) after pass i
+class caustic_renderer {
+public:
+	caustic_renderer(
+		const render_settings& settings,
+		const camera& c,
+		const hittable& w,
+		shared_ptr<hittable> l,
+		const hittable& caster_list,
+		int photons,
+		double initial_radius,
+		int tile
+	) : rs(settings), cam(c), world(w), lights(l), casters(caster_list), photons_per_pass(photons),
+		radius(initial_radius), alpha(2.0 / 3.0), pass(0), fb(settings.img_width, settings.img_height),
+		tiles(make_tiles(settings.img_width, settings.img_height, tile)) {}
+
+	void render_pass(thread_pool& pool) {
+		//photons are traced in chunks with their own seeds, so the map does
+		//not depend on the number of threads
+		const int chunks = 64;
+		std::vector<std::vector<photon>> traced(chunks);
+		for (auto c = 0; c < chunks; ++c) {
+			pool.submit([this, c, &traced] {
+				seed_random(mix_seed(mix_seed(rs.seed ^ 0x9e3779b9u, pass), c));
+				auto count = photons_per_pass / chunks + (c < photons_per_pass % chunks ? 1 : 0);
+				trace_caustic_photons(world, lights, casters, rs.max_depth, count, photons_per_pass, traced[c]);
+			});
+		}
+		pool.wait();
+
+		std::vector<photon> stored;
+		for (auto& chunk : traced)
+			stored.insert(stored.end(), chunk.begin(), chunk.end());
+		map.build(std::move(stored));
+
+		auto s0 = pass;
+		for (const auto& t : tiles) {
+			pool.submit([this, t, s0] {
+				std::vector<float> buffer(3 * t.pixels());
+				render_tile_caustics(t, s0, s0 + 1, rs, cam, world, lights, map, radius, buffer.data());
+				fb.add_tile(t, buffer.data(), 1);
+			});
+		}
+		pool.wait();
+
+		radius *= sqrt((pass + alpha) / (pass + 1));
+		++pass;
+	}
+
+	void run(thread_pool& pool, int passes) {
+		while (pass < passes) {
+			render_pass(pool);
+			std::cerr << "\rPass " << pass << " of " << passes << " (" << map.size() << " caustic photons) " << std::flush;
+		}
+		std::cerr << '\n';
+	}
+
+public:
+	render_settings rs;
+	const camera& cam;
+	const hittable& world;
+	shared_ptr<hittable> lights;
+	const hittable& casters;
+	int photons_per_pass;
+	double radius;
+	double alpha;
+	int pass;
+	photon_map map;
+	framebuffer fb;
+	std::vector<tile> tiles;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+//time-budgeted rendering: instead of a sample count the render gets a wall
+//clock deadline. Work is handed out in rounds; every round the remaining
+//time is split among tiles greedily by expected error reduction per second,
+//using the measured cost per sample of each tile and a variance estimate
+//from two half buffers (even and odd sample indices).
+
+#include "render.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <queue>
+#include <string>
+#include <vector>
+
+class deadline_renderer {
+public:
+	using clock = std::chrono::steady_clock;
+
+	deadline_renderer(
+		const render_settings& settings,
+		const camera& c,
+		const hittable& w,
+		shared_ptr<hittable> l,
+		int tile_size
+	) : rs(settings), cam(c), world(w), lights(l),
+		fb(settings.img_width, settings.img_height), odd(settings.img_width, settings.img_height),
+		tiles(make_tiles(settings.img_width, settings.img_height, tile_size)), stats(tiles.size()) {}
+
+	void run(thread_pool& pool, double seconds);
+	void report(std::ostream& out) const;
+	bool write_report(const std::string& path) const;
+
+public:
+	struct tile_stats {
+		int samples = 0;
+		double seconds = 0;   //time spent rendering the tile
+		double variance = 1;  //relative per-sample variance estimate
+		int planned = 0;      //samples assigned in the current round
+	};
+
+	render_settings rs;
+	const camera& cam;
+	const hittable& world;
+	shared_ptr<hittable> lights;
+	framebuffer fb;  //all samples
+	framebuffer odd; //samples with odd index only
+	std::vector<tile> tiles;
+	std::vector<tile_stats> stats;
+
+private:
+	double cost(size_t k) const {
+		const auto& s = stats[k];
+		return s.samples > 0 ? s.seconds / s.samples : 1.0;
+	}
+
+	void render_samples(size_t k, int n, clock::time_point deadline);
+	void estimate_variance(size_t k);
+};
+
+//render up to n more samples of tile k one at a time, stopping before a
+//sample that would not finish by the deadline
+void deadline_renderer::render_samples(size_t k, int n, clock::time_point deadline) {
+	const auto& t = tiles[k];
+	auto& s = stats[k];
+	std::vector<float> buffer(3 * t.pixels());
+	for (auto i = 0; i < n; ++i) {
+		auto start = clock::now();
+		if (s.samples > 0 && start + std::chrono::duration<double>(cost(k)) > deadline)
+			break;
+
+		render_tile(t, s.samples, s.samples + 1, rs, cam, world, lights, buffer.data());
+		fb.add_tile(t, buffer.data(), 1);
+		if (s.samples % 2 == 1)
+			odd.add_tile(t, buffer.data(), 1);
+
+		std::chrono::duration<double> elapsed = clock::now() - start;
+		s.seconds += elapsed.count();
+		++s.samples;
+	}
+}
+
+//per-sample variance relative to pixel brightness, from the difference of
+//the even and odd half estimates, averaged over the tile
+void deadline_renderer::estimate_variance(size_t k) {
+	const auto& t = tiles[k];
+	auto& s = stats[k];
+	auto n_odd = s.samples / 2;
+	auto n_even = s.samples - n_odd;
+	if (n_odd == 0)
+		return;
+
+	auto lum = [](const color& c) { return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z(); };
+	auto sum = 0.0;
+	for (auto j = t.y0; j < t.y1; ++j) {
+		for (auto i = t.x0; i < t.x1; ++i) {
+			auto all = lum(fb.pixel(i, j));
+			auto b = lum(odd.pixel(i, j));
+			auto d = (all - b) / n_even - b / n_odd;
+			auto mean = all / s.samples;
+			sum += d * d / (1.0 / n_even + 1.0 / n_odd) / (mean * mean + 0.01);
+		}
+	}
+	s.variance = sum / t.pixels() + 1e-6;
+}
+
+void deadline_renderer::run(thread_pool& pool, double seconds) {
+	auto start = clock::now();
+	auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+
+	//two samples everywhere to get costs and a first variance estimate
+	for (size_t k = 0; k < tiles.size(); ++k)
+		pool.submit([this, k, deadline] { render_samples(k, 2, deadline); });
+	pool.wait();
+
+	while (true) {
+		for (size_t k = 0; k < tiles.size(); ++k)
+			estimate_variance(k);
+
+		std::chrono::duration<double> remaining = deadline - clock::now();
+		if (remaining.count() <= 0)
+			break;
+
+		//short rounds keep the plan close to the measured costs, the last
+		//rounds shrink with the remaining time
+		auto round = std::max(std::min(remaining.count(), 0.25 * seconds), std::min(remaining.count(), 0.01));
+		auto capacity = round * pool.size();
+
+		//greedily give single samples to the tile where one more sample
+		//reduces the error the most per second of work
+		using entry = std::pair<double, size_t>;
+		std::priority_queue<entry> queue;
+		auto gain = [this](size_t k) {
+			auto n = stats[k].samples + stats[k].planned;
+			return stats[k].variance * (1.0 / n - 1.0 / (n + 1)) / cost(k);
+		};
+		for (size_t k = 0; k < tiles.size(); ++k) {
+			stats[k].planned = 0;
+			queue.push(entry(gain(k), k));
+		}
+		while (capacity > 0 && !queue.empty()) {
+			auto k = queue.top().second;
+			queue.pop();
+			++stats[k].planned;
+			capacity -= cost(k);
+			queue.push(entry(gain(k), k));
+		}
+
+		//tiles with the most work first so that the round ends evenly
+		std::vector<size_t> order;
+		for (size_t k = 0; k < tiles.size(); ++k)
+			if (stats[k].planned > 0)
+				order.push_back(k);
+		std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+			return stats[a].planned * cost(a) > stats[b].planned * cost(b);
+		});
+
+		auto before = 0;
+		for (const auto& s : stats)
+			before += s.samples;
+		for (auto k : order)
+			pool.submit([this, k, deadline] { render_samples(k, stats[k].planned, deadline); });
+		pool.wait();
+
+		auto after = 0;
+		for (const auto& s : stats)
+			after += s.samples;
+		if (after == before)
+			break;
+
+		std::chrono::duration<double> elapsed = clock::now() - start;
+		std::cerr << "\rElapsed " << std::fixed << std::setprecision(1) << elapsed.count()
+			<< " s, " << after / static_cast<double>(tiles.size()) << " spp on average " << std::flush;
+	}
+	std::cerr << '\n';
+}
+
+//spp reached per tile as a grid, top row first
+void deadline_renderer::report(std::ostream& out) const {
+	auto min_spp = stats.empty() ? 0 : stats[0].samples;
+	auto max_spp = min_spp;
+	auto total = 0.0;
+	for (size_t k = 0; k < tiles.size(); ++k) {
+		min_spp = std::min(min_spp, stats[k].samples);
+		max_spp = std::max(max_spp, stats[k].samples);
+		total += static_cast<double>(stats[k].samples) * tiles[k].pixels();
+	}
+	out << "spp per tile (min " << min_spp << ", mean " << std::setprecision(1) << std::fixed
+		<< total / (rs.img_width * rs.img_height) << ", max " << max_spp << "):\n";
+
+	auto columns = 0;
+	while (columns < static_cast<int>(tiles.size()) && tiles[columns].y0 == tiles[0].y0)
+		++columns;
+	for (auto row = static_cast<int>(tiles.size()) / columns - 1; row >= 0; --row) {
+		for (auto c = 0; c < columns; ++c)
+			out << std::setw(6) << stats[row * columns + c].samples;
+		out << '\n';
+	}
+}
+
+bool deadline_renderer::write_report(const std::string& path) const {
+	std::ofstream out(path);
+	out << "x0,y0,x1,y1,spp,seconds,relative_variance\n";
+	for (size_t k = 0; k < tiles.size(); ++k) {
+		const auto& t = tiles[k];
+		out << t.x0 << ',' << t.y0 << ',' << t.x1 << ',' << t.y1 << ',' << stats[k].samples << ','
+			<< stats[k].seconds << ',' << stats[k].variance << '\n';
+	}
+	return static_cast<bool>(out);
+}
+
+#endif
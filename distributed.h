@@ -0,0 +1,493 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+//coordinator/worker rendering over TCP. The coordinator splits the frame
+//into (tile, sample range) jobs, workers render them with their own copy
+//of the scene and send back float sums which the coordinator merges.
+//Only available on POSIX systems.
+
+#ifndef _WIN32
+
+#include "render.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <thread>
+#include <vector>
+
+//messages are sent as raw structs of 32 bit fields followed by raw floats,
+//so all nodes are expected to share endianness
+const std::int32_t dist_magic = 0x32545045; // "EPT2"
+
+struct setup_msg {
+	std::int32_t magic;
+	std::int32_t img_width;
+	std::int32_t img_height;
+	std::int32_t max_depth;
+	float background[3];
+	std::uint32_t seed;
+	std::int32_t integrator;
+	std::int32_t sampler;
+};
+
+struct job_msg {
+	std::int32_t id; // negative id tells the worker to exit
+	std::int32_t x0;
+	std::int32_t y0;
+	std::int32_t x1;
+	std::int32_t y1;
+	std::int32_t s0;
+	std::int32_t s1;
+};
+
+struct result_msg {
+	std::int32_t id;
+	std::int32_t count; // number of floats following the header
+};
+
+inline bool send_all(int fd, const void* data, size_t size) {
+	auto p = static_cast<const char*>(data);
+	while (size > 0) {
+		auto n = send(fd, p, size, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t size) {
+	auto p = static_cast<char*>(data);
+	while (size > 0) {
+		auto n = recv(fd, p, size, 0);
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+int connect_to(const std::string& host, int port) {
+	addrinfo hints;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	addrinfo* res = nullptr;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0)
+		return -1;
+
+	int fd = -1;
+	for (auto ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			//results go out as a header and a payload; without this the
+			//payload waits for the coordinator's delayed ack
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+//connect to a coordinator and render jobs until told to stop; the scene is
+//built once by the caller and reused for every job
+bool run_worker(
+	const std::string& host,
+	int port,
+	render_settings rs,
+	const camera& cam,
+	const hittable& world,
+	shared_ptr<hittable> lights
+) {
+	int fd = -1;
+	for (auto attempt = 0; attempt < 50 && fd < 0; ++attempt) {
+		fd = connect_to(host, port);
+		if (fd < 0)
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+	if (fd < 0) {
+		std::cerr << "worker: cannot connect to " << host << ':' << port << '\n';
+		return false;
+	}
+
+	setup_msg setup;
+	if (!recv_all(fd, &setup, sizeof(setup)) || setup.magic != dist_magic
+		|| setup.integrator < 0 || setup.integrator > static_cast<std::int32_t>(integrator_type::mixture)
+		|| setup.sampler < 0 || setup.sampler > static_cast<std::int32_t>(sampler_type::r2)) {
+		std::cerr << "worker: bad handshake\n";
+		close(fd);
+		return false;
+	}
+	rs.img_width = setup.img_width;
+	rs.img_height = setup.img_height;
+	rs.max_depth = setup.max_depth;
+	rs.background = color(setup.background[0], setup.background[1], setup.background[2]);
+	rs.seed = setup.seed;
+	rs.integrator = static_cast<integrator_type>(setup.integrator);
+	rs.sampler = static_cast<sampler_type>(setup.sampler);
+
+	std::vector<float> buffer;
+	job_msg job;
+	while (recv_all(fd, &job, sizeof(job)) && job.id >= 0) {
+		tile t = { job.x0, job.y0, job.x1, job.y1 };
+		buffer.resize(3 * t.pixels());
+		render_tile(t, job.s0, job.s1, rs, cam, world, lights, buffer.data());
+
+		result_msg res = { job.id, static_cast<std::int32_t>(buffer.size()) };
+		if (!send_all(fd, &res, sizeof(res)) || !send_all(fd, buffer.data(), buffer.size() * sizeof(float)))
+			break;
+	}
+	close(fd);
+	return true;
+}
+
+class coordinator {
+public:
+	coordinator(
+		const render_settings& settings,
+		const camera& c,
+		const hittable& w,
+		shared_ptr<hittable> l
+	) : straggler_factor(3.0), worker_timeout(30.0), hang_factor(20.0), min_hang_time(60.0),
+		rs(settings), cam(c), world(w), lights(l), listen_fd(-1), port(0) {}
+
+	~coordinator() {
+		if (listen_fd >= 0)
+			close(listen_fd);
+	}
+
+	//loopback only unless all_interfaces is set; any peer that can connect
+	//can add tiles to the frame
+	bool listen_on(int port, bool all_interfaces = false);
+	void spawn_local_workers(int n);
+	void run(const std::vector<tile>& tiles, int chunk_spp, framebuffer& fb);
+
+public:
+	//a job running longer than straggler_factor times the mean job time is
+	//handed to an idle worker as well, and the first result wins
+	double straggler_factor;
+	//with no workers connected for this long the coordinator renders itself
+	double worker_timeout;
+	//a worker whose job runs longer than hang_factor times the mean job time,
+	//and at least min_hang_time seconds, is dropped as hung even if it is
+	//still connected, and its job goes back to the queue. Until a job has
+	//finished there is no mean to compare with and nobody is dropped.
+	double hang_factor;
+	double min_hang_time;
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	struct job {
+		tile t;
+		int s0;
+		int s1;
+		bool done;
+		int running;
+	};
+
+	struct connection {
+		int fd;
+		int job;
+		clock::time_point started;
+	};
+
+	void accept_worker();
+	bool assign(connection& w, int id);
+	void drop(connection& w);
+	int find_straggler() const;
+	double hang_limit() const;
+
+private:
+	render_settings rs;
+	const camera& cam;
+	const hittable& world;
+	shared_ptr<hittable> lights;
+
+	int listen_fd;
+	int port;
+	std::vector<pid_t> children;
+	std::vector<connection> workers;
+	std::vector<job> jobs;
+	std::deque<int> pending;
+	double job_time_sum;
+	int jobs_timed;
+};
+
+bool coordinator::listen_on(int p, bool all_interfaces) {
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		return false;
+
+	int one = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	sockaddr_in addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(all_interfaces ? INADDR_ANY : INADDR_LOOPBACK);
+	addr.sin_port = htons(static_cast<uint16_t>(p));
+
+	if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	port = p;
+	return true;
+}
+
+void coordinator::spawn_local_workers(int n) {
+	std::cout.flush();
+	std::cerr.flush();
+	for (auto i = 0; i < n; ++i) {
+		pid_t pid = fork();
+		if (pid == 0) {
+			close(listen_fd);
+			run_worker("127.0.0.1", port, rs, cam, world, lights);
+			_exit(0);
+		}
+		if (pid > 0)
+			children.push_back(pid);
+	}
+}
+
+void coordinator::accept_worker() {
+	int fd = accept(listen_fd, nullptr, nullptr);
+	if (fd < 0)
+		return;
+
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	//a worker that stops mid-message is treated as dead
+	timeval tv = { 10, 0 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	setup_msg setup;
+	setup.magic = dist_magic;
+	setup.img_width = rs.img_width;
+	setup.img_height = rs.img_height;
+	setup.max_depth = rs.max_depth;
+	setup.background[0] = static_cast<float>(rs.background.x());
+	setup.background[1] = static_cast<float>(rs.background.y());
+	setup.background[2] = static_cast<float>(rs.background.z());
+	setup.seed = rs.seed;
+	setup.integrator = static_cast<std::int32_t>(rs.integrator);
+	setup.sampler = static_cast<std::int32_t>(rs.sampler);
+	if (!send_all(fd, &setup, sizeof(setup))) {
+		close(fd);
+		return;
+	}
+	workers.push_back({ fd, -1, clock::now() });
+}
+
+bool coordinator::assign(connection& w, int id) {
+	const job& j = jobs[id];
+	job_msg msg = { id, j.t.x0, j.t.y0, j.t.x1, j.t.y1, j.s0, j.s1 };
+	if (!send_all(w.fd, &msg, sizeof(msg)))
+		return false;
+	w.job = id;
+	w.started = clock::now();
+	++jobs[id].running;
+	return true;
+}
+
+void coordinator::drop(connection& w) {
+	if (w.job >= 0) {
+		job& j = jobs[w.job];
+		if (--j.running == 0 && !j.done)
+			pending.push_front(w.job);
+		w.job = -1;
+	}
+	close(w.fd);
+	w.fd = -1;
+}
+
+int coordinator::find_straggler() const {
+	if (jobs_timed == 0)
+		return -1;
+	auto limit = straggler_factor * job_time_sum / jobs_timed;
+	auto now = clock::now();
+	for (const auto& w : workers) {
+		if (w.job < 0 || jobs[w.job].done || jobs[w.job].running > 1)
+			continue;
+		std::chrono::duration<double> elapsed = now - w.started;
+		if (elapsed.count() > limit)
+			return w.job;
+	}
+	return -1;
+}
+
+double coordinator::hang_limit() const {
+	if (jobs_timed == 0)
+		return infty;
+	return std::max(min_hang_time, hang_factor * job_time_sum / jobs_timed);
+}
+
+void coordinator::run(const std::vector<tile>& tiles, int chunk_spp, framebuffer& fb) {
+	jobs.clear();
+	pending.clear();
+	job_time_sum = 0;
+	jobs_timed = 0;
+	for (const auto& t : tiles)
+		for (auto s = 0; s < rs.samples_per_pixel; s += chunk_spp)
+			jobs.push_back({ t, s, std::min(s + chunk_spp, rs.samples_per_pixel), false, 0 });
+	for (auto i = 0; i < static_cast<int>(jobs.size()); ++i)
+		pending.push_back(i);
+
+	auto remaining = jobs.size();
+	auto last_worker_seen = clock::now();
+	auto wait_for_workers = worker_timeout;
+	std::vector<float> buffer;
+
+	size_t reported = 0;
+	while (remaining > 0) {
+		if (remaining != reported) {
+			std::cerr << "\rJobs remaining: " << remaining << " workers: " << workers.size() << ' ' << std::flush;
+			reported = remaining;
+		}
+
+		std::vector<pollfd> fds;
+		fds.push_back({ listen_fd, POLLIN, 0 });
+		for (const auto& w : workers)
+			fds.push_back({ w.fd, POLLIN, 0 });
+		poll(fds.data(), fds.size(), 100);
+
+		if (fds[0].revents & POLLIN)
+			accept_worker();
+
+		for (size_t k = 1; k < fds.size(); ++k) {
+			if (!fds[k].revents)
+				continue;
+			auto& w = workers[k - 1];
+
+			result_msg res;
+			if (w.job < 0 || !recv_all(w.fd, &res, sizeof(res)) || res.id != w.job
+				|| res.count != 3 * jobs[res.id].t.pixels()) {
+				drop(w);
+				continue;
+			}
+			buffer.resize(res.count);
+			if (!recv_all(w.fd, buffer.data(), buffer.size() * sizeof(float))) {
+				drop(w);
+				continue;
+			}
+
+			job& j = jobs[res.id];
+			--j.running;
+			w.job = -1;
+			if (!j.done) {
+				fb.add_tile(j.t, buffer.data(), j.s1 - j.s0);
+				j.done = true;
+				--remaining;
+				std::chrono::duration<double> elapsed = clock::now() - w.started;
+				job_time_sum += elapsed.count();
+				++jobs_timed;
+			}
+		}
+
+		//stopped or deadlocked workers keep their connection open but never
+		//answer; after a hang there is no point in waiting for new workers
+		auto now = clock::now();
+		auto limit = hang_limit();
+		for (auto& w : workers) {
+			std::chrono::duration<double> busy = now - w.started;
+			if (w.fd >= 0 && w.job >= 0 && busy.count() > limit) {
+				drop(w);
+				wait_for_workers = 0;
+			}
+		}
+
+		for (auto& w : workers) {
+			if (w.fd < 0 || w.job >= 0)
+				continue;
+			while (!pending.empty() && jobs[pending.front()].done)
+				pending.pop_front();
+			int id = -1;
+			if (!pending.empty()) {
+				id = pending.front();
+				pending.pop_front();
+			}
+			else {
+				id = find_straggler();
+			}
+			if (id < 0)
+				break;
+			if (!assign(w, id)) {
+				if (jobs[id].running == 0)
+					pending.push_front(id);
+				drop(w);
+			}
+		}
+
+		workers.erase(std::remove_if(workers.begin(), workers.end(),
+			[](const connection& w) { return w.fd < 0; }), workers.end());
+
+		if (!workers.empty()) {
+			last_worker_seen = clock::now();
+			continue;
+		}
+
+		//nobody left to do the work, render the next pending job here
+		std::chrono::duration<double> idle = clock::now() - last_worker_seen;
+		while (!pending.empty() && jobs[pending.front()].done)
+			pending.pop_front();
+		if (idle.count() >= wait_for_workers && !pending.empty()) {
+			job& j = jobs[pending.front()];
+			pending.pop_front();
+			buffer.resize(3 * j.t.pixels());
+			render_tile(j.t, j.s0, j.s1, rs, cam, world, lights, buffer.data());
+			fb.add_tile(j.t, buffer.data(), j.s1 - j.s0);
+			j.done = true;
+			--remaining;
+		}
+	}
+
+	job_msg stop = { -1, 0, 0, 0, 0, 0, 0 };
+	for (auto& w : workers) {
+		send_all(w.fd, &stop, sizeof(stop));
+		close(w.fd);
+	}
+	workers.clear();
+	//local workers that were dropped as hung never saw the stop message
+	auto deadline = clock::now() + std::chrono::seconds(5);
+	for (auto pid : children) {
+		while (waitpid(pid, nullptr, WNOHANG) == 0) {
+			if (clock::now() > deadline) {
+				kill(pid, SIGKILL);
+				waitpid(pid, nullptr, 0);
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+	}
+	children.clear();
+}
+
+#endif
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "utils.h"
+#include "color.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//rectangle of pixels [x0, x1) x [y0, y1), rows counted from the bottom
+//of the image like the j index of the original render loop
+struct tile {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+
+	int width() const { return x1 - x0; }
+	int height() const { return y1 - y0; }
+	int pixels() const { return width() * height(); }
+};
+
+std::vector<tile> make_tiles(int img_width, int img_height, int tile_size) {
+	std::vector<tile> tiles;
+	for (auto y = 0; y < img_height; y += tile_size)
+		for (auto x = 0; x < img_width; x += tile_size)
+			tiles.push_back({ x, y, std::min(x + tile_size, img_width), std::min(y + tile_size, img_height) });
+	return tiles;
+}
+
+//un-normalized radiance sums, 3 floats per pixel, and the number of
+//samples that went into every pixel
+class framebuffer {
+public:
+	framebuffer() : width(0), height(0) {}
+	framebuffer(int w, int h) : width(w), height(h), sum(3 * w * h, 0.0f), count(w * h, 0) {}
+
+	//add a tile-sized block of rgb sums, laid out row by row, that holds
+	//the given number of samples per pixel
+	void add_tile(const tile& t, const float* data, int samples) {
+		for (auto y = t.y0; y < t.y1; ++y) {
+			float* row = &sum[3 * (y * width + t.x0)];
+			for (auto i = 0; i < 3 * t.width(); ++i)
+				row[i] += *data++;
+			int* n = &count[y * width + t.x0];
+			for (auto i = 0; i < t.width(); ++i)
+				n[i] += samples;
+		}
+	}
+
+	//drop all samples of the pixels of t
+	void clear_tile(const tile& t) {
+		for (auto y = t.y0; y < t.y1; ++y) {
+			std::fill_n(&sum[3 * (y * width + t.x0)], 3 * t.width(), 0.0f);
+			std::fill_n(&count[y * width + t.x0], t.width(), 0);
+		}
+	}
+
+	color pixel(int x, int y) const {
+		const float* p = &sum[3 * (y * width + x)];
+		return color(p[0], p[1], p[2]);
+	}
+
+	color mean(int x, int y) const {
+		auto n = count[y * width + x];
+		return n > 0 ? pixel(x, y) / n : color(0, 0, 0);
+	}
+
+	void write_ppm(std::ostream& out) const {
+		out << "P3\n" << width << ' ' << height << "\n255\n";
+		for (auto j = height - 1; j >= 0; --j)
+			for (auto i = 0; i < width; ++i)
+				write_color(out, mean(i, j), 1);
+	}
+
+	//mean radiance as little-endian PFM; PFM stores the bottom row first,
+	//which is the row order of the buffer
+	bool write_pfm(const std::string& path) const {
+		std::ofstream out(path, std::ios::binary);
+		if (!out)
+			return false;
+		out << "PF\n" << width << ' ' << height << "\n-1.0\n";
+		std::vector<float> row(3 * width);
+		for (auto j = 0; j < height; ++j) {
+			for (auto i = 0; i < width; ++i) {
+				auto m = mean(i, j);
+				row[3 * i + 0] = static_cast<float>(m.x());
+				row[3 * i + 1] = static_cast<float>(m.y());
+				row[3 * i + 2] = static_cast<float>(m.z());
+			}
+			out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+		}
+		return static_cast<bool>(out);
+	}
+
+	//load a PFM written by write_pfm, the sums then hold one sample per pixel
+	bool read_pfm(const std::string& path) {
+		std::ifstream in(path, std::ios::binary);
+		std::string magic;
+		float scale;
+		if (!(in >> magic >> width >> height >> scale) || magic != "PF" || scale > 0)
+			return false;
+		in.get();
+		sum.resize(3 * width * height);
+		count.assign(width * height, 1);
+		in.read(reinterpret_cast<char*>(sum.data()), sum.size() * sizeof(float));
+		return static_cast<bool>(in);
+	}
+
+	//sum += scale * other, per channel, leaving the counts alone
+	void add_scaled(const framebuffer& other, const color& scale) {
+		for (size_t k = 0; k < sum.size(); k += 3) {
+			sum[k + 0] += static_cast<float>(scale.x()) * other.sum[k + 0];
+			sum[k + 1] += static_cast<float>(scale.y()) * other.sum[k + 1];
+			sum[k + 2] += static_cast<float>(scale.z()) * other.sum[k + 2];
+		}
+	}
+
+public:
+	int width;
+	int height;
+	std::vector<float> sum;
+	std::vector<int> count;
+};
+
+#endif
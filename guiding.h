@@ -0,0 +1,450 @@
+#ifndef GUIDING_H
+#define GUIDING_H
+
+//path guiding with an SD-tree (Mueller et al., practical path guiding): a
+//binary tree over space whose leaves hold a quadtree over directions of the
+//incident radiance seen there. Training passes splat radiance into the
+//"building" quadtrees, between passes the trees are refined single-threaded
+//and the learned quadtrees become the "sampling" ones. During a pass the
+//structure is fixed; threads only read the sampling trees and add to the
+//building trees with atomic float adds.
+
+#include "utils.h"
+#include "hittable.h"
+#include "material.h"
+#include "camera.h"
+#include "pdf.h"
+#include "render.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+inline void atomic_add(std::atomic<float>& a, float x) {
+	auto cur = a.load(std::memory_order_relaxed);
+	while (!a.compare_exchange_weak(cur, cur + x, std::memory_order_relaxed)) {}
+}
+
+inline double luminance(const color& c) {
+	return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
+//directions map to the unit square by cylindrical coordinates,
+//u = (cos(theta) + 1) / 2 and v = phi / 2pi, which preserves area:
+//a density p on the square is p / 4pi per steradian
+inline void direction_to_square(const vec3& d, double& u, double& v) {
+	auto w = unit_vector(d);
+	u = clamp(0.5 * (w.z() + 1), 0.0, 0.999999);
+	auto phi = atan2(w.y(), w.x());
+	if (phi < 0)
+		phi += 2 * PI;
+	v = clamp(phi / (2 * PI), 0.0, 0.999999);
+}
+
+inline vec3 square_to_direction(double u, double v) {
+	auto z = 2 * u - 1;
+	auto r = sqrt(std::max(0.0, 1 - z * z));
+	auto phi = 2 * PI * v;
+	return vec3(r * cos(phi), r * sin(phi), z);
+}
+
+struct dtree_node {
+	dtree_node() {
+		for (auto q = 0; q < 4; ++q) {
+			sum[q].store(0, std::memory_order_relaxed);
+			child[q] = 0;
+		}
+	}
+
+	dtree_node(const dtree_node& other) {
+		*this = other;
+	}
+
+	dtree_node& operator=(const dtree_node& other) {
+		for (auto q = 0; q < 4; ++q) {
+			sum[q].store(other.sum[q].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			child[q] = other.child[q];
+		}
+		return *this;
+	}
+
+	//quadrant q covers u in the upper half if q & 1, v if q & 2
+	static int quadrant(double& u, double& v) {
+		int q = 0;
+		u *= 2;
+		v *= 2;
+		if (u >= 1) {
+			u -= 1;
+			q |= 1;
+		}
+		if (v >= 1) {
+			v -= 1;
+			q |= 2;
+		}
+		return q;
+	}
+
+	float total() const {
+		return sum[0].load(std::memory_order_relaxed) + sum[1].load(std::memory_order_relaxed)
+			+ sum[2].load(std::memory_order_relaxed) + sum[3].load(std::memory_order_relaxed);
+	}
+
+	std::atomic<float> sum[4];
+	std::uint32_t child[4]; //0 for a leaf quadrant; node 0 is the root
+};
+
+//directional quadtree; every node keeps the energy of its four quadrants,
+//so the sums of inner nodes always equal those of their children
+class dtree {
+public:
+	dtree() : nodes(1), samples(0) {}
+
+	dtree(const dtree& other) {
+		*this = other;
+	}
+
+	dtree& operator=(const dtree& other) {
+		nodes = other.nodes;
+		samples.store(other.samples.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		return *this;
+	}
+
+	double total() const {
+		return nodes[0].total();
+	}
+
+	//every sample counts towards the spatial split, zero ones included
+	void record(const vec3& direction, double value) {
+		samples.fetch_add(1, std::memory_order_relaxed);
+		if (value <= 0)
+			return;
+		double u, v;
+		direction_to_square(direction, u, v);
+		std::uint32_t n = 0;
+		while (true) {
+			auto q = dtree_node::quadrant(u, v);
+			atomic_add(nodes[n].sum[q], static_cast<float>(value));
+			if (!nodes[n].child[q])
+				break;
+			n = nodes[n].child[q];
+		}
+	}
+
+	//only valid if total() > 0
+	vec3 sample() const {
+		auto u0 = 0.0, v0 = 0.0, size = 1.0;
+		std::uint32_t n = 0;
+		while (true) {
+			const auto& node = nodes[n];
+			auto r = random_double() * node.total();
+			int q = 0;
+			while (q < 3 && r >= node.sum[q].load(std::memory_order_relaxed)) {
+				r -= node.sum[q].load(std::memory_order_relaxed);
+				++q;
+			}
+			size *= 0.5;
+			u0 += (q & 1) ? size : 0;
+			v0 += (q & 2) ? size : 0;
+			if (!node.child[q])
+				break;
+			n = node.child[q];
+		}
+		return square_to_direction(u0 + size * random_double(), v0 + size * random_double());
+	}
+
+	//solid angle density of sample()
+	double pdf(const vec3& direction) const {
+		double u, v;
+		direction_to_square(direction, u, v);
+		auto p = 1.0 / (4 * PI);
+		std::uint32_t n = 0;
+		while (true) {
+			const auto& node = nodes[n];
+			auto t = node.total();
+			if (t <= 0)
+				return 0;
+			auto q = dtree_node::quadrant(u, v);
+			p *= 4 * node.sum[q].load(std::memory_order_relaxed) / t;
+			if (!node.child[q])
+				return p;
+			n = node.child[q];
+		}
+	}
+
+	//empty tree whose quadrants are subdivided wherever this tree saw more
+	//than the fraction rho of its energy
+	dtree refined(double rho, int max_depth) const {
+		dtree result;
+		auto t = total();
+		if (t > 0)
+			refine_node(result, 0, 0, 0.25 * t, t * rho, 1, max_depth);
+		return result;
+	}
+
+public:
+	std::vector<dtree_node> nodes;
+	std::atomic<unsigned> samples;
+
+private:
+	//src is the matching node of this tree or -1 below its leaves, where
+	//the energy of the leaf is assumed to be spread evenly
+	void refine_node(dtree& result, std::uint32_t dst, long src, double even_energy,
+		double threshold, int depth, int max_depth) const {
+		for (auto q = 0; q < 4; ++q) {
+			auto energy = src >= 0 ? nodes[src].sum[q].load(std::memory_order_relaxed) : even_energy;
+			if (energy <= threshold || depth >= max_depth)
+				continue;
+			auto child = static_cast<std::uint32_t>(result.nodes.size());
+			result.nodes.emplace_back();
+			result.nodes[dst].child[q] = child;
+			long src_child = src >= 0 && nodes[src].child[q] ? static_cast<long>(nodes[src].child[q]) : -1;
+			refine_node(result, child, src_child, 0.25 * energy, threshold, depth + 1, max_depth);
+		}
+	}
+};
+
+struct guide_leaf {
+	dtree sampling;
+	dtree building;
+};
+
+//binary tree over the scene bounds; nodes split at the middle of their box,
+//cycling through x, y and z
+class path_guide {
+public:
+	//fraction of bounces sampled from the guide where it has data; the rest
+	//use the bsdf, and both are weighted by one-sample mis
+	double guide_fraction = 0.5;
+	//leaves split once they recorded more than spatial_threshold * sqrt(spp)
+	//samples in a pass of spp samples per pixel; lower than the paper's
+	//12000 because the images here are a fraction of its 720p
+	double spatial_threshold = 4000;
+	//quadrants split where they hold more than this fraction of the energy
+	double directional_threshold = 0.01;
+	int max_directional_depth = 20;
+
+	path_guide(const hittable& world) : nodes(1), leaves(1) {
+		aabb box;
+		if (!world.bounding_box(box))
+			box = aabb(point3(-1e3, -1e3, -1e3), point3(1e3, 1e3, 1e3));
+		//cubic bounds keep the cells of the cycling splits close to cubes
+		auto extent = std::max(box.max().x() - box.min().x(),
+			std::max(box.max().y() - box.min().y(), box.max().z() - box.min().z()));
+		bounds_min = box.min();
+		bounds_max = box.min() + vec3(extent, extent, extent);
+	}
+
+	guide_leaf& leaf_at(const point3& p) {
+		auto lo = bounds_min, hi = bounds_max;
+		std::uint32_t n = 0;
+		while (nodes[n].child) {
+			auto axis = nodes[n].axis;
+			auto mid = 0.5 * (lo[axis] + hi[axis]);
+			if (p[axis] < mid) {
+				hi[axis] = mid;
+				n = nodes[n].child;
+			}
+			else {
+				lo[axis] = mid;
+				n = nodes[n].child + 1;
+			}
+		}
+		return leaves[nodes[n].leaf];
+	}
+
+	//direction and mixture pdf for a bounce off a diffuse surface: the
+	//guide or the integrator's own sampling. A leaf that has learned nothing
+	//yet bounces exactly like ray_color, random numbers included.
+	bool sample_bounce(
+		const guide_leaf& leaf,
+		const hit_record& rec,
+		shared_ptr<hittable> lights,
+		integrator_type integrator,
+		ray& scattered,
+		double& pdf_val
+	) const {
+		if (leaf.sampling.total() <= 0)
+			return ::sample_bounce(rec, lights, integrator, scattered, pdf_val);
+
+		if (random_double() < guide_fraction)
+			scattered = ray(rec.p, leaf.sampling.sample());
+		else
+			::sample_bounce(rec, lights, integrator, scattered, pdf_val);
+		auto direction = scattered.direction();
+		pdf_val = (1 - guide_fraction) * bounce_pdf(rec, lights, integrator, direction)
+			+ guide_fraction * leaf.sampling.pdf(direction);
+		return pdf_val > 0;
+	}
+
+	//call between passes, with no rendering in flight: split busy spatial
+	//leaves, then let the learned trees guide the next pass
+	void refine(int pass_spp) {
+		auto limit = spatial_threshold * sqrt(static_cast<double>(pass_spp));
+		for (std::uint32_t n = 0; n < nodes.size(); ++n) {
+			if (!nodes[n].child && leaves[nodes[n].leaf].building.samples.load() > limit)
+				split(n);
+		}
+		for (auto& leaf : leaves) {
+			auto next = leaf.building.refined(directional_threshold, max_directional_depth);
+			leaf.sampling = leaf.building;
+			leaf.building = next;
+		}
+	}
+
+	size_t spatial_leaves() const {
+		return leaves.size();
+	}
+
+private:
+	struct snode {
+		int axis = 0;
+		std::uint32_t child = 0; //first of two consecutive children, 0 for a leaf
+		std::uint32_t leaf = 0;
+	};
+
+	//both halves start from the parent's trees with half its sample count;
+	//the loop in refine() visits the new children and splits them further
+	void split(std::uint32_t n) {
+		auto child = static_cast<std::uint32_t>(nodes.size());
+		auto axis = nodes[n].axis;
+		auto& parent = leaves[nodes[n].leaf];
+		parent.building.samples.store(parent.building.samples.load() / 2);
+		guide_leaf copy = parent;
+		leaves.push_back(copy);
+
+		snode first, second;
+		first.axis = second.axis = (axis + 1) % 3;
+		first.leaf = nodes[n].leaf;
+		second.leaf = static_cast<std::uint32_t>(leaves.size() - 1);
+		nodes[n].child = child;
+		nodes.push_back(first);
+		nodes.push_back(second);
+	}
+
+private:
+	point3 bounds_min;
+	point3 bounds_max;
+	std::vector<snode> nodes;
+	std::vector<guide_leaf> leaves;
+};
+
+//ray_color with diffuse bounces drawn from the guide; while training, the
+//radiance arriving through each bounce is recorded for the next pass
+color ray_color_guided(
+	const ray& r,
+	const color& background,
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	integrator_type integrator,
+	path_guide& guide,
+	bool training,
+	int depth
+) {
+	hit_record rec;
+
+	if (depth <= 0)
+		return color(0, 0, 0);
+
+	if (!world.hit(r, 0.001, infty, rec))
+		return background;
+
+	scatter_record srec;
+	color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+
+	if (!rec.mat_ptr->scatter(r, rec, srec))
+		return emitted;
+
+	if (srec.is_specular) {
+		return srec.attenuation * ray_color_guided(srec.specular_ray, background, world, lights, integrator,
+			guide, training, depth - 1);
+	}
+
+	auto& leaf = guide.leaf_at(rec.p);
+	ray scattered;
+	double pdf_val;
+	if (!guide.sample_bounce(leaf, rec, lights, integrator, scattered, pdf_val))
+		return emitted;
+
+	//directions into the surface carry nothing; recording them would only
+	//teach the guide about light seen through the back of thin walls
+	auto scattering_pdf = rec.mat_ptr->scattering_pdf(r, rec, scattered);
+	auto incoming = ray_color_guided(scattered, background, world, lights, integrator, guide, training, depth - 1);
+	if (training && scattering_pdf > 0) {
+		auto value = luminance(incoming) / pdf_val;
+		if (value < infty)
+			leaf.building.record(scattered.direction(), value);
+	}
+
+	return emitted + srec.attenuation * scattering_pdf * incoming / pdf_val;
+}
+
+void render_tile_guided(
+	const tile& t,
+	int s0,
+	int s1,
+	const render_settings& rs,
+	const camera& cam,
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	path_guide& guide,
+	bool training,
+	float* out
+) {
+	render_tile_with(t, s0, s1, rs, cam, out, [&](const ray& r) {
+		return ray_color_guided(r, rs.background, world, lights, rs.integrator, guide, training, rs.max_depth);
+	});
+}
+
+//training passes of 1, 2, 4, ... samples per pixel refine the guide and
+//are discarded; the final image is rendered with the learned guide
+class guided_renderer {
+public:
+	guided_renderer(const render_settings& settings, const camera& c, const hittable& w, shared_ptr<hittable> l, int tile)
+		: rs(settings), cam(c), world(w), lights(l), guide(w), next_sample(0),
+		fb(settings.img_width, settings.img_height),
+		tiles(make_tiles(settings.img_width, settings.img_height, tile)) {}
+
+	void train(thread_pool& pool, int passes) {
+		for (auto k = 0; k < passes; ++k) {
+			auto spp = 1 << k;
+			std::cerr << "\rTraining pass " << k + 1 << " of " << passes << " (" << spp << " spp) " << std::flush;
+			framebuffer discarded(rs.img_width, rs.img_height);
+			render_pass(pool, spp, true, discarded);
+			guide.refine(spp);
+		}
+		if (passes > 0)
+			std::cerr << "\nGuide: " << guide.spatial_leaves() << " spatial leaves\n";
+	}
+
+	void render(thread_pool& pool) {
+		render_pass(pool, rs.samples_per_pixel, false, fb);
+	}
+
+public:
+	render_settings rs;
+	const camera& cam;
+	const hittable& world;
+	shared_ptr<hittable> lights;
+	path_guide guide;
+	int next_sample; //training and final samples use disjoint random sequences
+	framebuffer fb;
+	std::vector<tile> tiles;
+
+private:
+	void render_pass(thread_pool& pool, int spp, bool training, framebuffer& target) {
+		auto s0 = next_sample;
+		auto s1 = s0 + spp;
+		for (const auto& t : tiles) {
+			pool.submit([this, t, s0, s1, spp, training, &target] {
+				std::vector<float> buffer(3 * t.pixels());
+				render_tile_guided(t, s0, s1, rs, cam, world, lights, guide, training, buffer.data());
+				target.add_tile(t, buffer.data(), spp);
+			});
+		}
+		pool.wait();
+		next_sample = s1;
+	}
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define HITTABLE_H
 
 #include "utils.h"
+#include "aabb.h"
 
 class material;
 
@@ -24,6 +25,8 @@ struct hit_record {
 class hittable {
 public:
 	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+	//false for unbounded objects such as infinite planes
+	virtual bool bounding_box(aabb& output_box) const = 0;
 	virtual double pdf_value(const point3& o, const vec3& v) const {
 		return 0.0;
 	}
@@ -32,6 +35,19 @@ public:
 		return vec3(1, 0, 0);
 	}
 
+	//point with outward normal drawn uniformly over the surface, whose area
+	//is returned as the inverse of the density; false if not supported
+	virtual bool sample_surface(point3& p, vec3& normal, double& area) const {
+		return false;
+	}
+
+	//recompute cached bounds after objects inside have moved
+	virtual void refit() {}
+
+	//highest light group of the materials inside, -1 if nothing emits
+	virtual int max_light_group() const {
+		return -1;
+	}
 };
 
 class flip_face : public hittable {
@@ -49,8 +65,75 @@ public:
 		return true;
 	}
 
+	virtual bool bounding_box(aabb& output_box) const override {
+		return ptr->bounding_box(output_box);
+	}
+
+	virtual void refit() override {
+		ptr->refit();
+	}
+
+	virtual int max_light_group() const override {
+		return ptr->max_light_group();
+	}
+
+public:
+	shared_ptr<hittable> ptr;
+};
+
+//object moved by offset; the offset may change between frames, followed by
+//a refit of the bvh_node holding it
+class translate : public hittable {
+public:
+	translate(shared_ptr<hittable> p, const vec3& displacement)
+		: ptr(p), offset(displacement) {}
+
+	virtual bool hit(
+		const ray& r, double t_min, double t_max, hit_record& rec
+	) const override {
+		ray moved_r(r.origin() - offset, r.direction());
+		if (!ptr->hit(moved_r, t_min, t_max, rec))
+			return false;
+
+		rec.p += offset;
+		return true;
+	}
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		if (!ptr->bounding_box(output_box))
+			return false;
+
+		output_box = aabb(output_box.min() + offset, output_box.max() + offset);
+		return true;
+	}
+
+	virtual double pdf_value(const point3& o, const vec3& v) const override {
+		return ptr->pdf_value(o - offset, v);
+	}
+
+	virtual vec3 random(const point3& o) const override {
+		return ptr->random(o - offset);
+	}
+
+	virtual bool sample_surface(point3& p, vec3& normal, double& area) const override {
+		if (!ptr->sample_surface(p, normal, area))
+			return false;
+
+		p += offset;
+		return true;
+	}
+
+	virtual void refit() override {
+		ptr->refit();
+	}
+
+	virtual int max_light_group() const override {
+		return ptr->max_light_group();
+	}
+
 public:
 	shared_ptr<hittable> ptr;
+	vec3 offset;
 };
 
 #endif
@@ -2,6 +2,7 @@
 #define HITTABLE_LIST_H
 
 #include "hittable.h"
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -18,9 +19,21 @@ public:
 
 	virtual bool hit(
 		const ray& r, double t_min, double t_max, hit_record& rec) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
 	
 	virtual double pdf_value(const vec3& o, const vec3& v) const override;
 	virtual vec3 random(const vec3& o) const override;
+	virtual bool sample_surface(point3& p, vec3& normal, double& area) const override;
+	virtual void refit() override {
+		for (const auto& object : objects)
+			object->refit();
+	}
+	virtual int max_light_group() const override {
+		auto g = -1;
+		for (const auto& object : objects)
+			g = std::max(g, object->max_light_group());
+		return g;
+	}
 public:
 	std::vector<shared_ptr<hittable>> objects;
 };
@@ -41,6 +54,21 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 	return hit_anything;
 }
 
+bool hittable_list::bounding_box(aabb& output_box) const {
+	if (objects.empty()) return false;
+
+	aabb temp_box;
+	bool first_box = true;
+
+	for (const auto& object : objects) {
+		if (!object->bounding_box(temp_box)) return false;
+		output_box = first_box ? temp_box : surrounding_box(output_box, temp_box);
+		first_box = false;
+	}
+
+	return true;
+}
+
 double hittable_list::pdf_value(const point3& o, const vec3& v) const {
 	auto weight = 1.0 / objects.size();
 	auto sum = 0.0;
@@ -56,4 +84,18 @@ vec3 hittable_list::random(const vec3& o) const {
 	return objects[random_int(0, int_size - 1)]->random(o);
 }
 
+//a uniformly chosen object, so the density is that of the object divided
+//by the number of objects
+bool hittable_list::sample_surface(point3& p, vec3& normal, double& area) const {
+	if (objects.empty())
+		return false;
+
+	auto int_size = static_cast<int>(objects.size());
+	if (!objects[random_int(0, int_size - 1)]->sample_surface(p, normal, area))
+		return false;
+
+	area *= int_size;
+	return true;
+}
+
 #endif
\ No newline at end of file
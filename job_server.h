@@ -0,0 +1,491 @@
+#ifndef JOB_SERVER_H
+#define JOB_SERVER_H
+
+//long-running render server on a Unix socket. Clients send one command per
+//line and get replies as lines on the same connection:
+//  render NAME [light=x,y,z] [radius=R] [color=r,g,b] [lookfrom=x,y,z]
+//         [lookat=x,y,z] [vfov=V] [spp=N] [depth=D] [width=W] [height=H]
+//         [seed=S] [out=FILE]                  -> queued NAME
+//  cancel NAME                                 -> cancelling NAME
+//  status                                      -> status QUEUED RUNNING SCENES
+//  shutdown                                    -> bye
+//and once a job ends: done NAME SECONDS (built|cached), cancelled NAME or
+//failed NAME. Up to max_jobs jobs run at once, each on its own job thread
+//and renderer, with their tiles interleaved on one shared thread pool, so a
+//small job does not wait for a large one to finish. Built scenes stay in an
+//LRU cache shared by the job threads, so repeated jobs skip building the
+//scene and its bvh. Only available on POSIX systems.
+
+#ifndef _WIN32
+
+#include "renderer.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//least recently used scenes by scene_desc::key
+class scene_cache {
+public:
+	scene_cache(size_t cap) : capacity(cap) {}
+
+	//the cached scene, or a freshly built one that is then cached
+	shared_ptr<const loaded_scene> get(const scene_desc& desc, bool& hit) {
+		auto key = desc.key();
+		auto found = index.find(key);
+		hit = found != index.end();
+		if (hit) {
+			entries.splice(entries.begin(), entries, found->second);
+			return found->second->second;
+		}
+
+		auto scene = build_scene(desc);
+		entries.emplace_front(key, scene);
+		index[key] = entries.begin();
+		while (entries.size() > capacity) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+		return scene;
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+
+private:
+	using entry = std::pair<std::string, shared_ptr<const loaded_scene>>;
+
+	size_t capacity;
+	std::list<entry> entries;
+	std::map<std::string, std::list<entry>::iterator> index;
+};
+
+//largest image a job may ask for, about 8k x 4k; the framebuffer alone
+//takes 16 bytes per pixel
+const std::int64_t max_job_pixels = std::int64_t(1) << 25;
+
+struct render_job {
+	std::string name;
+	int client;
+	scene_desc scene;
+	point3 lookfrom;
+	point3 lookat;
+	double vfov;
+	int samples_per_pixel;
+	int max_depth;
+	int width;
+	int height;
+	unsigned int seed;
+	std::string output;
+	std::atomic<bool> cancel;
+};
+
+class job_server {
+public:
+	job_server(int threads, size_t cache_size, int max_jobs)
+		: pool(threads), cache(cache_size), job_threads(max_jobs), listen_fd(-1), cached_scenes(0),
+		stopping(false), next_client(0) {
+		wake_fds[0] = wake_fds[1] = -1;
+	}
+
+	~job_server() {
+		if (listen_fd >= 0) {
+			close(listen_fd);
+			unlink(socket_path.c_str());
+		}
+		for (auto fd : wake_fds) {
+			if (fd >= 0)
+				close(fd);
+		}
+	}
+
+	bool listen_on(const std::string& path);
+
+	//serves clients until a shutdown command arrives
+	void run();
+
+private:
+	struct client {
+		int id;
+		int fd;
+		std::string input;
+	};
+
+	void accept_client();
+	void handle_line(client& c, const std::string& line);
+	bool parse_job(std::istringstream& tokens, render_job& job, std::string& error) const;
+	void reply(int client_id, const std::string& line);
+	void flush_replies();
+	std::string run_job(renderer& r, render_job& job);
+	void work();
+
+private:
+	thread_pool pool;
+	scene_cache cache;
+	std::mutex cache_mutex; //held while a scene is looked up or built
+	int job_threads;
+	std::string socket_path;
+	int listen_fd;
+	int wake_fds[2]; //job threads write a byte here when replies are waiting
+
+	std::mutex mutex;
+	std::condition_variable job_added;
+	std::deque<shared_ptr<render_job>> queue;
+	std::map<std::string, shared_ptr<render_job>> active; //queued or running, by name
+	std::vector<std::pair<int, std::string>> replies;
+	size_t cached_scenes;
+	bool stopping;
+
+	std::vector<client> clients;
+	int next_client;
+};
+
+bool job_server::listen_on(const std::string& path) {
+	sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path))
+		return false;
+	std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		return false;
+	//a socket file left behind by a server that did not shut down cleanly
+	unlink(path.c_str());
+	if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(listen_fd, 16) < 0
+		|| pipe(wake_fds) < 0) {
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+	fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+	socket_path = path;
+	return true;
+}
+
+void job_server::accept_client() {
+	int fd = accept(listen_fd, nullptr, nullptr);
+	if (fd >= 0)
+		clients.push_back({ next_client++, fd, std::string() });
+}
+
+void job_server::reply(int client_id, const std::string& line) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		replies.emplace_back(client_id, line + "\n");
+	}
+	char byte = 0;
+	if (write(wake_fds[1], &byte, 1) < 0) {
+		//the pipe is full, so a wake-up is pending anyway
+	}
+}
+
+void job_server::flush_replies() {
+	char drain[64];
+	while (read(wake_fds[0], drain, sizeof(drain)) > 0) {}
+
+	std::vector<std::pair<int, std::string>> pending;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pending.swap(replies);
+	}
+	//replies to clients that disconnected are dropped
+	for (const auto& r : pending) {
+		for (auto& c : clients) {
+			if (c.id == r.first && c.fd >= 0 && send(c.fd, r.second.data(), r.second.size(), MSG_NOSIGNAL) < 0) {
+				close(c.fd);
+				c.fd = -1;
+			}
+		}
+	}
+}
+
+bool job_server::parse_job(std::istringstream& tokens, render_job& job, std::string& error) const {
+	if (!(tokens >> job.name)) {
+		error = "render needs a job name";
+		return false;
+	}
+	auto view = default_view();
+	auto rs = default_render_settings();
+	job.scene = default_scene();
+	job.lookfrom = view.lookfrom;
+	job.lookat = view.lookat;
+	job.vfov = view.vfov;
+	job.samples_per_pixel = rs.samples_per_pixel;
+	job.max_depth = rs.max_depth;
+	job.width = rs.img_width;
+	job.height = rs.img_height;
+	job.seed = rs.seed;
+	job.output = job.name + ".ppm";
+
+	std::string token;
+	while (tokens >> token) {
+		auto eq = token.find('=');
+		auto key = token.substr(0, eq);
+		auto value = eq == std::string::npos ? std::string() : token.substr(eq + 1);
+		bool ok = !value.empty();
+		if (key == "light")
+			ok = ok && parse_vec3(value, job.scene.light_loc);
+		else if (key == "radius")
+			job.scene.light_radius = atof(value.c_str());
+		else if (key == "color")
+			ok = ok && parse_vec3(value, job.scene.light_color);
+		else if (key == "lookfrom")
+			ok = ok && parse_vec3(value, job.lookfrom);
+		else if (key == "lookat")
+			ok = ok && parse_vec3(value, job.lookat);
+		else if (key == "vfov")
+			job.vfov = atof(value.c_str());
+		else if (key == "spp")
+			job.samples_per_pixel = atoi(value.c_str());
+		else if (key == "depth")
+			job.max_depth = atoi(value.c_str());
+		else if (key == "width")
+			job.width = atoi(value.c_str());
+		else if (key == "height")
+			job.height = atoi(value.c_str());
+		else if (key == "seed")
+			job.seed = static_cast<unsigned int>(strtoul(value.c_str(), nullptr, 10));
+		else if (key == "out")
+			job.output = value;
+		else
+			ok = false;
+		if (!ok) {
+			error = "bad entry '" + token + "'";
+			return false;
+		}
+	}
+	if (job.width <= 0 || job.height <= 0 || job.samples_per_pixel <= 0 || job.max_depth <= 0) {
+		error = "image size, spp and depth must be positive";
+		return false;
+	}
+	if (static_cast<std::int64_t>(job.width) * job.height > max_job_pixels) {
+		error = "image larger than " + std::to_string(max_job_pixels) + " pixels";
+		return false;
+	}
+	if (job.scene.light_radius <= 0 || job.vfov <= 0 || job.vfov >= 180) {
+		error = "radius must be positive and vfov between 0 and 180";
+		return false;
+	}
+	return true;
+}
+
+void job_server::handle_line(client& c, const std::string& line) {
+	std::istringstream tokens(line);
+	std::string command;
+	if (!(tokens >> command))
+		return;
+
+	if (command == "render") {
+		auto job = std::make_shared<render_job>();
+		job->client = c.id;
+		job->cancel = false;
+		std::string error;
+		if (!parse_job(tokens, *job, error)) {
+			reply(c.id, "error " + error);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!active.count(job->name)) {
+				active[job->name] = job;
+				queue.push_back(job);
+				error.clear();
+			}
+			else {
+				error = "job " + job->name + " already exists";
+			}
+		}
+		if (!error.empty()) {
+			reply(c.id, "error " + error);
+			return;
+		}
+		job_added.notify_one();
+		reply(c.id, "queued " + job->name);
+	}
+	else if (command == "cancel") {
+		std::string name;
+		tokens >> name;
+		bool found = false;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto job = active.find(name);
+			if (job != active.end()) {
+				job->second->cancel = true;
+				found = true;
+			}
+		}
+		reply(c.id, found ? "cancelling " + name : "error unknown job " + name);
+	}
+	else if (command == "status") {
+		std::ostringstream status;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			status << "status " << queue.size() << ' ' << active.size() - queue.size() << ' ' << cached_scenes;
+		}
+		reply(c.id, status.str());
+	}
+	else if (command == "shutdown") {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			for (auto& job : active)
+				job.second->cancel = true;
+		}
+		job_added.notify_all();
+		reply(c.id, "bye");
+	}
+	else {
+		reply(c.id, "error unknown command " + command);
+	}
+}
+
+//renders one job and returns its reply line
+std::string job_server::run_job(renderer& r, render_job& job) {
+	auto start = std::chrono::steady_clock::now();
+	bool hit;
+	{
+		std::lock_guard<std::mutex> lock(cache_mutex);
+		r.set_scene(cache.get(job.scene, hit));
+		std::lock_guard<std::mutex> stats_lock(mutex);
+		cached_scenes = cache.size();
+	}
+	r.set_camera(job.lookfrom, job.lookat, job.vfov);
+	r.set_image(job.width, job.height);
+	r.set_sampling(job.samples_per_pixel, job.max_depth, integrator_type::bsdf, sampler_type::random, job.seed);
+
+	if (!r.render(&job.cancel))
+		return "cancelled " + job.name;
+
+	std::ofstream out(job.output);
+	r.image().write_ppm(out);
+	if (!out)
+		return "failed " + job.name;
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	std::ostringstream done;
+	done << "done " << job.name << ' ' << elapsed.count() << (hit ? " cached" : " built");
+	return done.str();
+}
+
+void job_server::work() {
+	renderer r(pool);
+	while (true) {
+		shared_ptr<render_job> job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_added.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (queue.empty())
+				return;
+			job = queue.front();
+			queue.pop_front();
+		}
+
+		std::string result;
+		if (job->cancel) {
+			result = "cancelled " + job->name;
+		}
+		else {
+			//out of memory and the like fail this job, not the server
+			try {
+				result = run_job(r, *job);
+			}
+			catch (const std::exception&) {
+				result = "failed " + job->name;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			active.erase(job->name);
+		}
+		reply(job->client, result);
+	}
+}
+
+void job_server::run() {
+	std::vector<std::thread> workers;
+	for (auto k = 0; k < job_threads; ++k)
+		workers.emplace_back([this] { work(); });
+
+	while (true) {
+		std::vector<pollfd> fds;
+		fds.push_back({ listen_fd, POLLIN, 0 });
+		fds.push_back({ wake_fds[0], POLLIN, 0 });
+		for (const auto& c : clients)
+			fds.push_back({ c.fd, POLLIN, 0 });
+		poll(fds.data(), fds.size(), -1);
+
+		if (fds[1].revents & POLLIN)
+			flush_replies();
+
+		for (size_t k = 2; k < fds.size(); ++k) {
+			if (!fds[k].revents)
+				continue;
+			auto& c = clients[k - 2];
+			char buffer[4096];
+			auto n = recv(c.fd, buffer, sizeof(buffer), 0);
+			if (n <= 0) {
+				close(c.fd);
+				c.fd = -1;
+				continue;
+			}
+			c.input.append(buffer, n);
+			size_t eol;
+			while ((eol = c.input.find('\n')) != std::string::npos) {
+				auto line = c.input.substr(0, eol);
+				c.input.erase(0, eol + 1);
+				handle_line(c, line);
+			}
+		}
+
+		if (fds[0].revents & POLLIN)
+			accept_client();
+
+		bool stop;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = stopping;
+		}
+		if (stop)
+			break;
+
+		clients.erase(std::remove_if(clients.begin(), clients.end(),
+			[](const client& c) { return c.fd < 0; }), clients.end());
+	}
+
+	for (auto& worker : workers)
+		worker.join();
+	//final replies, including the bye and those of cancelled jobs
+	flush_replies();
+	for (auto& c : clients) {
+		if (c.fd >= 0)
+			close(c.fd);
+	}
+	clients.clear();
+}
+
+#endif
+
+#endif
@@ -4,112 +4,440 @@
 #include "color.h"
 #include "utils.h"
 #include "material.h"
+#include "render.h"
+#include "framebuffer.h"
+#include "distributed.h"
+#include "scenes.h"
+#include "sweep.h"
+#include "progressive.h"
+#include "deadline.h"
+#include "benchmark.h"
+#include "animation.h"
+#include "tile_writer.h"
+#include "guiding.h"
+#include "caustics.h"
+#include "renderer.h"
+#include "job_server.h"
+#include "thread_pool.h"
 
+#include <chrono>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
 
-hittable_list simple_scene(const point3& loc, const double& radius, const color& col) {
-	hittable_list objects;
+//recombine per-light buffers written by --light-buffers with new rgb scales:
+//  --relight out.ppm light0.pfm r g b [light1.pfm r g b ...]
+int relight(int argc, char* argv[]) {
+	auto start = std::chrono::steady_clock::now();
+	if (argc < 7 || (argc - 3) % 4 != 0) {
+		std::cerr << "usage: " << argv[0] << " --relight OUT.ppm IN.pfm R G B [IN.pfm R G B ...]\n";
+		return 1;
+	}
 
-	auto material_left = make_shared<lambertian>(color(0.75, 0.25, 0.25));
-	auto material_right = make_shared<lambertian>(color(0.25, 0.25, 0.75));
-	auto material_back = make_shared<lambertian>(color(0.75, 0.75, 0.75));
-	//auto material_front = make_shared<lambertian>(color());
-	auto material_bot = make_shared<lambertian>(color(0.75, 0.75, 0.75));
-	auto material_top = make_shared<lambertian>(color(0.75, 0.75, 0.75));
+	framebuffer result;
+	framebuffer layer;
+	for (auto a = 3; a < argc; a += 4) {
+		if (!layer.read_pfm(argv[a])) {
+			std::cerr << "cannot read " << argv[a] << '\n';
+			return 1;
+		}
+		if (result.sum.empty()) {
+			result = framebuffer(layer.width, layer.height);
+			result.count.assign(result.count.size(), 1);
+		}
+		if (layer.width != result.width || layer.height != result.height) {
+			std::cerr << argv[a] << " does not match the size of the other buffers\n";
+			return 1;
+		}
+		result.add_scaled(layer, color(atof(argv[a + 1]), atof(argv[a + 2]), atof(argv[a + 3])));
+	}
 
-	auto material_first = make_shared<dielectric>(1.5);
-	auto material_second = make_shared<metal>(color(1, 1, 1), 0.2);
+	std::ofstream out(argv[2]);
+	result.write_ppm(out);
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	std::cerr << "Relit in " << elapsed.count() << " ms\n";
+	return out ? 0 : 1;
+}
 
-	auto difflight = make_shared<diffuse_light>(col);
+int main(int argc, char* argv[]) {
+	if (argc > 1 && !strcmp(argv[1], "--relight"))
+		return relight(argc, argv);
 
+	render_settings rs = default_render_settings();
+	const int img_width = rs.img_width;
+	const int img_height = rs.img_height;
+	const auto asp_ratio = static_cast<double>(img_width) / img_height;
+	const int samples_per_pixel = rs.samples_per_pixel;
 
-	objects.add(make_shared<sphere>(point3(1e5+1, 40.8, 81.6), 1e5, material_left));
-	objects.add(make_shared<sphere>(point3(-1e5 + 99, 40.8, 81.6), 1e5, material_right));
-	objects.add(make_shared<sphere>(point3(50, 40.8, 1e5), 1e5, material_back));
-	//objects.add(make_shared<sphere>(point3(50, 40.8, -1e5+170), 1e5, material_front));
-	objects.add(make_shared<sphere>(point3(50, 1e5, 81.6), 1e5, material_bot));
-	objects.add(make_shared<sphere>(point3(50, -1e5+81.6, 81.6), 1e5, material_top));
-	objects.add(make_shared<sphere>(point3(27, 16.5, 47), 16.5, material_first));
-	objects.add(make_shared<sphere>(point3(73, 16.5, 78), 16.5, material_second));
-	objects.add(make_shared<sphere>(loc, radius, difflight));
-	return objects;
-}
+	int tile_size = 32;
+	int workers = -1;
+	int port = 5555;
+	bool listen_all = false;
+	int chunk_spp = samples_per_pixel;
+	double hang_factor = 20;
+	double hang_min = 60;
+	std::string worker_of;
+	std::string light_prefix;
+	std::string sweep_file;
+	int threads = 0;
+	bool correlated = false;
+	int samples_per_pass = 0;
+	int passes = 0;
+	int checkpoint_every = 1;
+	std::string checkpoint_path;
+	std::string resume_path;
+	double deadline = 0;
+	std::string report_path;
+	integrator_type integrator = integrator_type::bsdf;
+	sampler_type sampler = sampler_type::random;
+	std::string benchmark_csv;
+	std::string references_dir = "references";
+	std::vector<double> budgets = { 0.5, 1, 2, 4, 8 };
+	int reference_spp = 0;
+	std::string sequence_file;
+	std::string frame_pattern = "frame_%04d.ppm";
+	std::string out_path;
+	int training_passes = -1;
+	int caustic_photons = 0;
+	double caustic_radius = 1.0;
+	std::string serve_path;
+	int cache_size = 4;
+	int max_jobs = 2;
+
+	for (auto a = 1; a < argc; ++a) {
+		if (!strcmp(argv[a], "--workers") && a + 1 < argc)
+			workers = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--port") && a + 1 < argc)
+			port = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--listen-all"))
+			listen_all = true;
+		else if (!strcmp(argv[a], "--worker") && a + 1 < argc)
+			worker_of = argv[++a];
+		else if (!strcmp(argv[a], "--tile") && a + 1 < argc)
+			tile_size = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--chunk") && a + 1 < argc)
+			chunk_spp = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--hang-factor") && a + 1 < argc)
+			hang_factor = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--hang-min") && a + 1 < argc)
+			hang_min = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--light-buffers") && a + 1 < argc)
+			light_prefix = argv[++a];
+		else if (!strcmp(argv[a], "--sweep") && a + 1 < argc)
+			sweep_file = argv[++a];
+		else if (!strcmp(argv[a], "--threads") && a + 1 < argc)
+			threads = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--correlated"))
+			correlated = true;
+		else if (!strcmp(argv[a], "--progressive") && a + 1 < argc)
+			samples_per_pass = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--passes") && a + 1 < argc)
+			passes = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--checkpoint") && a + 1 < argc)
+			checkpoint_path = argv[++a];
+		else if (!strcmp(argv[a], "--checkpoint-every") && a + 1 < argc)
+			checkpoint_every = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--resume") && a + 1 < argc)
+			resume_path = argv[++a];
+		else if (!strcmp(argv[a], "--deadline") && a + 1 < argc)
+			deadline = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--report") && a + 1 < argc)
+			report_path = argv[++a];
+		else if (!strcmp(argv[a], "--integrator") && a + 1 < argc && !strcmp(argv[a + 1], "bsdf")) {
+			integrator = integrator_type::bsdf;
+			++a;
+		}
+		else if (!strcmp(argv[a], "--integrator") && a + 1 < argc && !strcmp(argv[a + 1], "mixture")) {
+			integrator = integrator_type::mixture;
+			++a;
+		}
+		else if (!strcmp(argv[a], "--sampler") && a + 1 < argc && !strcmp(argv[a + 1], "random")) {
+			sampler = sampler_type::random;
+			++a;
+		}
+		else if (!strcmp(argv[a], "--sampler") && a + 1 < argc && !strcmp(argv[a + 1], "r2")) {
+			sampler = sampler_type::r2;
+			++a;
+		}
+		else if (!strcmp(argv[a], "--benchmark") && a + 1 < argc)
+			benchmark_csv = argv[++a];
+		else if (!strcmp(argv[a], "--references") && a + 1 < argc)
+			references_dir = argv[++a];
+		else if (!strcmp(argv[a], "--make-references") && a + 1 < argc)
+			reference_spp = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--sequence") && a + 1 < argc)
+			sequence_file = argv[++a];
+		else if (!strcmp(argv[a], "--frames-out") && a + 1 < argc)
+			frame_pattern = argv[++a];
+		else if (!strcmp(argv[a], "--guided") && a + 1 < argc)
+			training_passes = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--caustics") && a + 1 < argc)
+			caustic_photons = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--caustic-radius") && a + 1 < argc)
+			caustic_radius = atof(argv[++a]);
+		else if (!strcmp(argv[a], "--serve") && a + 1 < argc)
+			serve_path = argv[++a];
+		else if (!strcmp(argv[a], "--cache") && a + 1 < argc)
+			cache_size = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--jobs") && a + 1 < argc)
+			max_jobs = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "--out") && a + 1 < argc)
+			out_path = argv[++a];
+		else if (!strcmp(argv[a], "--budgets") && a + 1 < argc) {
+			budgets.clear();
+			std::istringstream list(argv[++a]);
+			std::string item;
+			while (std::getline(list, item, ','))
+				budgets.push_back(atof(item.c_str()));
+		}
+		else {
+			std::cerr << "usage: " << argv[0] << " [--integrator bsdf|mixture] [--sampler random|r2] [--threads N] <mode options>\n"
+				<< "       " << argv[0] << " --out FILE.ppm [--tile T] [--threads N]\n"
+				<< "       " << argv[0] << " [--workers N] [--port P] [--listen-all] [--worker HOST:PORT] [--tile T] [--chunk S] [--hang-factor F] [--hang-min SECONDS] [--light-buffers PREFIX]\n"
+				<< "       " << argv[0] << " --progressive SPP_PER_PASS [--passes N] [--checkpoint FILE] [--checkpoint-every K] [--resume FILE] [--threads N]\n"
+				<< "       " << argv[0] << " --guided TRAINING_PASSES [--threads N]\n"
+				<< "       " << argv[0] << " --caustics PHOTONS_PER_PASS [--caustic-radius R] [--threads N]\n"
+				<< "       " << argv[0] << " --deadline SECONDS [--report FILE] [--threads N]\n"
+				<< "       " << argv[0] << " --benchmark OUT.csv [--budgets 0.5,1,2] [--references DIR] [--make-references SPP]\n"
+				<< "       " << argv[0] << " --sequence FILE [--frames-out frame_%04d.ppm]\n"
+				<< "       " << argv[0] << " --sweep FILE [--threads N] [--correlated] [--tile T]\n"
+				<< "       " << argv[0] << " --serve SOCKET [--cache SCENES] [--jobs N] [--threads N]\n"
+				<< "       " << argv[0] << " --relight OUT.ppm IN.pfm R G B [IN.pfm R G B ...]\n";
+			return 1;
+		}
+	}
 
-color ray_color(
-	const ray& r, 
-	const color& background, 
-	const hittable& world, 
-	shared_ptr<hittable> lights,
-	int depth
-) {
-	hit_record rec;
+	if (tile_size <= 0) {
+		std::cerr << "--tile needs a positive size\n";
+		return 1;
+	}
 
-	if (depth <= 0)
-		return color(0, 0, 0);
+	const auto desc = default_scene();
+	const point3 loc = desc.light_loc;
+	const double radius = desc.light_radius;
+	const color col = desc.light_color;
+	auto scene = build_scene(desc);
+	const hittable_list& world = scene->world;
+	shared_ptr<hittable> lights = scene->lights;
 
-	if (!world.hit(r, 0.001, infty, rec))
-		return background;
+	const auto view = default_view();
+	const point3 lookfrom = view.lookfrom;
+	const point3 lookat = view.lookat;
+	const double vfov = view.vfov;
+	camera cam(lookfrom, lookat, vec3(0, 1, 0), vfov, asp_ratio);
 
-	scatter_record srec;
-	color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+	rs.integrator = integrator;
+	rs.sampler = sampler;
+	framebuffer fb(img_width, img_height);
+	auto tiles = make_tiles(img_width, img_height, tile_size);
 
-	if (!rec.mat_ptr->scatter(r, rec, srec))
-		return emitted;
+	if (!sweep_file.empty()) {
+		sweep_variant defaults = { loc, radius, col, lookfrom, lookat, vfov, samples_per_pixel, "" };
+		std::vector<sweep_variant> variants;
+		std::ifstream in(sweep_file);
+		if (!in || !read_sweep(in, defaults, variants)) {
+			std::cerr << "cannot read sweep file " << sweep_file << '\n';
+			return 1;
+		}
+		thread_pool pool(threads);
+		render_sweep(variants, rs, asp_ratio, tile_size, correlated, pool);
+		return 0;
+	}
 
-	if (srec.is_specular) {
-		return srec.attenuation * ray_color(srec.specular_ray, background, world, lights, depth - 1);
+	if (!sequence_file.empty()) {
+		std::string first_frame;
+		if (!frame_path(frame_pattern, 0, first_frame)) {
+			std::cerr << "bad frame pattern '" << frame_pattern << "', it needs exactly one %d or %0Nd\n";
+			return 1;
+		}
+		camera_key defaults = { 0, lookfrom, lookat, vfov };
+		animated_scene animated(loc, radius, col);
+		sequence seq;
+		std::ifstream in(sequence_file);
+		if (!in || !read_sequence(in, defaults, animated.object_names(), seq)) {
+			std::cerr << "cannot read sequence file " << sequence_file << '\n';
+			return 1;
+		}
+		thread_pool pool(threads);
+		render_sequence(seq, animated, rs, asp_ratio, tile_size, frame_pattern, pool);
+		return 0;
 	}
 
-	//auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
+	if (reference_spp > 0 || !benchmark_csv.empty()) {
+		thread_pool pool(threads);
+		if (reference_spp > 0 && !make_references(references_dir, reference_spp, pool))
+			return 1;
+		if (benchmark_csv.empty())
+			return 0;
+		std::ofstream csv(benchmark_csv);
+		return run_benchmark(references_dir, budgets, csv, pool) && csv ? 0 : 1;
+	}
 
-	cosine_pdf p(rec.normal);
+	if (training_passes >= 0) {
+		guided_renderer guided(rs, cam, world, lights, tile_size);
+		thread_pool pool(threads);
+		guided.train(pool, training_passes);
+		guided.render(pool);
+		guided.fb.write_ppm(std::cout);
+		std::cerr << "Done.\n";
+		return 0;
+	}
 
-	//hittable_pdf light_pdf(lights, rec.p);
-	//ray scattered = ray(rec.p, light_pdf.generate());
-	//auto pdf_val = light_pdf.value(scattered.direction());
+	if (caustic_photons > 0) {
+		//the specular balls of the box, where every caustic starts
+		hittable_list casters = cornell_balls();
+		caustic_renderer caustic(rs, cam, world, lights, casters, caustic_photons, caustic_radius, tile_size);
+		thread_pool pool(threads);
+		caustic.run(pool, samples_per_pixel);
+		caustic.fb.write_ppm(std::cout);
+		std::cerr << "Done.\n";
+		return 0;
+	}
 
-	ray scattered = ray(rec.p, p.generate());
-	auto pdf_val = p.value(scattered.direction());
+	if (deadline > 0) {
+		deadline_renderer timed(rs, cam, world, lights, tile_size);
+		thread_pool pool(threads);
+		timed.run(pool, deadline);
+		timed.fb.write_ppm(std::cout);
+		timed.report(std::cerr);
+		if (!report_path.empty() && !timed.write_report(report_path))
+			std::cerr << "cannot write " << report_path << '\n';
+		return 0;
+	}
 
-	return emitted + srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered) * ray_color(scattered, background, world, lights, depth - 1) / pdf_val;
-}
+	if (samples_per_pass > 0) {
+		if (passes <= 0)
+			passes = (samples_per_pixel + samples_per_pass - 1) / samples_per_pass;
+		progressive_renderer prog(rs, cam, world, lights, samples_per_pass, tile_size);
+		if (!resume_path.empty() && !prog.resume(resume_path)) {
+			std::cerr << "cannot resume from " << resume_path << '\n';
+			return 1;
+		}
+		signal(SIGINT, request_stop);
+		signal(SIGTERM, request_stop);
 
-int main() {
-	const auto asp_ratio = 16.0 / 9.0;
-	const int img_width = 500;
-	const int img_height = static_cast<int>(img_width / asp_ratio);
-	const int samples_per_pixel = 20;
-	const int max_depth = 10;
-	color background(0.0, 0.0, 0.0);	
-
-	const point3 loc = point3(50, 681.6-0.27, 81.6);
-	const double radius = 600;
-	const color col = color(15, 15, 15);
-
-	hittable_list world = simple_scene(loc, radius, col);
-	//auto difflight = make_shared<diffuse_light>(color(10, 10, 10));
-	shared_ptr<hittable> lights = make_shared<sphere>(loc, radius, shared_ptr<material>());
-
-	//add camera
-	const vec3 vup = vec3(0, 1, 0);
-	point3 lookfrom = point3(50, 50, 295.6);
-	point3 lookat = point3(50, 50, 50);
-	auto vfov = 30;
-	camera cam(lookfrom, lookat, vup, vfov, asp_ratio);
-
-	std::cout << "P3\n" << img_width << ' ' << img_height << "\n255\n";
-	for (auto j = img_height - 1; j >= 0; --j) {
-		std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-		for (auto i = 0; i < img_width; ++i) {
-			color pixel_color(0, 0, 0);
-			for (auto s = 0; s < samples_per_pixel; ++s) {
-				auto u = (i + random_double()) / (img_width - 1);
-				auto v = (j + random_double()) / (img_height - 1);
-				ray r = cam.get_ray(u, v);
-				pixel_color += ray_color(r, background, world, lights, max_depth);
+		thread_pool pool(threads);
+		bool finished = prog.run(pool, passes, checkpoint_path, checkpoint_every);
+		prog.fb.write_ppm(std::cout);
+		if (!finished) {
+			std::cerr << "\nStopped after pass " << prog.pass << ", resume with --resume " << checkpoint_path << '\n';
+			return 2;
+		}
+		std::cerr << "\nDone.\n";
+		return 0;
+	}
+
+#ifndef _WIN32
+	if (!serve_path.empty()) {
+		job_server server(threads, cache_size > 0 ? cache_size : 1, max_jobs > 0 ? max_jobs : 1);
+		if (!server.listen_on(serve_path)) {
+			std::cerr << "cannot listen on " << serve_path << '\n';
+			return 1;
+		}
+		std::cerr << "Serving on " << serve_path << '\n';
+		server.run();
+		return 0;
+	}
+
+	if (!worker_of.empty()) {
+		auto colon = worker_of.rfind(':');
+		if (colon == std::string::npos) {
+			std::cerr << "--worker expects HOST:PORT\n";
+			return 1;
+		}
+		return run_worker(worker_of.substr(0, colon), atoi(worker_of.c_str() + colon + 1),
+			rs, cam, world, lights) ? 0 : 1;
+	}
+
+	if (workers >= 0 && !light_prefix.empty()) {
+		std::cerr << "--light-buffers is not supported with distributed rendering\n";
+		return 1;
+	}
+
+	if (workers >= 0) {
+		coordinator coord(rs, cam, world, lights);
+		coord.hang_factor = hang_factor;
+		coord.min_hang_time = hang_min;
+		if (!coord.listen_on(port, listen_all)) {
+			std::cerr << "cannot listen on port " << port << '\n';
+			return 1;
+		}
+		coord.spawn_local_workers(workers);
+		coord.run(tiles, chunk_spp > 0 ? chunk_spp : samples_per_pixel, fb);
+		fb.write_ppm(std::cout);
+		std::cerr << "\nDone.\n";
+		return 0;
+	}
+#else
+	if (!serve_path.empty()) {
+		std::cerr << "the job server is not available on this platform\n";
+		return 1;
+	}
+
+	if (workers >= 0 || !worker_of.empty()) {
+		std::cerr << "distributed rendering is not available on this platform\n";
+		return 1;
+	}
+#endif
+
+	if (!light_prefix.empty()) {
+		const int light_groups = world.max_light_group() + 1;
+		rs.light_groups = light_groups;
+		std::vector<framebuffer> light_fbs(light_groups + 1, framebuffer(img_width, img_height));
+		std::vector<float> buffer;
+		for (size_t k = 0; k < tiles.size(); ++k) {
+			std::cerr << "\rTiles remaining: " << tiles.size() - k << ' ' << std::flush;
+			auto block = 3 * tiles[k].pixels();
+			buffer.resize((light_groups + 1) * block);
+			render_tile_groups(tiles[k], 0, samples_per_pixel, rs, cam, world, lights, buffer.data());
+			for (auto g = 0; g <= light_groups; ++g) {
+				light_fbs[g].add_tile(tiles[k], &buffer[g * block], samples_per_pixel);
+				fb.add_tile(tiles[k], &buffer[g * block], g == 0 ? samples_per_pixel : 0);
 			}
-			write_color(std::cout, pixel_color, samples_per_pixel);
 		}
+		for (auto g = 0; g <= light_groups; ++g) {
+			auto path = light_prefix + (g < light_groups ? "_light" + std::to_string(g) : std::string("_background")) + ".pfm";
+			if (!light_fbs[g].write_pfm(path))
+				std::cerr << "\ncannot write " << path;
+		}
+		fb.write_ppm(std::cout);
+		std::cerr << "\nDone.\n";
+		return 0;
+	}
+
+	if (!out_path.empty()) {
+		//tiles go straight from the render threads to the writer thread
+		tile_writer writer(img_width, img_height, tiles.size());
+		if (!writer.open(out_path)) {
+			std::cerr << "cannot open " << out_path << '\n';
+			return 1;
+		}
+		thread_pool pool(threads);
+		for (const auto& t : tiles) {
+			pool.submit([&, t] {
+				std::vector<float> buffer(3 * t.pixels());
+				render_tile(t, 0, samples_per_pixel, rs, cam, world, lights, buffer.data());
+				writer.submit(t, std::move(buffer), samples_per_pixel);
+			});
+		}
+		pool.wait();
+		if (!writer.finish()) {
+			std::cerr << "cannot write " << out_path << '\n';
+			return 1;
+		}
+		std::cerr << "Done.\n";
+		return 0;
 	}
-	std::cerr << "\nDone.\n";
-}
\ No newline at end of file
+
+	thread_pool pool(threads);
+	renderer r(pool);
+	r.set_scene(scene);
+	r.set_camera(lookfrom, lookat, vfov);
+	r.set_sampling(rs.samples_per_pixel, rs.max_depth, rs.integrator, rs.sampler, rs.seed);
+	r.set_tile_size(tile_size);
+	r.render();
+	r.image().write_ppm(std::cout);
+	std::cerr << "Done.\n";
+}
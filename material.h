@@ -35,6 +35,12 @@ public:
 	) const {
 		return 0;
 	}
+
+	//which per-light buffer the emission of this material is written to;
+	//-1 for materials that do not emit
+	virtual int light_group() const {
+		return -1;
+	}
 };
 
 class lambertian : public material {
@@ -150,8 +156,8 @@ private:
 
 class diffuse_light : public material {
 public:
-	diffuse_light(shared_ptr<texture> a) : emit(a) {}
-	diffuse_light(color c) : emit(make_shared<solid_color>(c)) {}
+	diffuse_light(shared_ptr<texture> a, int g = 0) : emit(a), group(g) {}
+	diffuse_light(color c, int g = 0) : emit(make_shared<solid_color>(c)), group(g) {}
 
 	virtual color emitted(const ray& r_in, const hit_record& rec, double u, double v, 
 		const point3& p) const override {
@@ -160,8 +166,13 @@ public:
 		return emit->value(u, v, p);
 	}
 
+	virtual int light_group() const override {
+		return group;
+	}
+
 public:
 	shared_ptr<texture> emit;
+	int group;
 };
 
 #endif
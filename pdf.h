@@ -104,4 +104,25 @@ public:
 	shared_ptr<hittable> ptr;
 };
 
+//equal-weight mixture of two pdfs; does not own them, so it is meant to be
+//built on the stack next to the pdfs it mixes
+class mixture_pdf : public pdf {
+public:
+	mixture_pdf(const pdf& p0, const pdf& p1) : p{ &p0, &p1 } {}
+
+	virtual double value(const vec3& direction) const override {
+		return 0.5 * p[0]->value(direction) + 0.5 * p[1]->value(direction);
+	}
+
+	virtual vec3 generate() const override {
+		if (random_double() < 0.5)
+			return p[0]->generate();
+		else
+			return p[1]->generate();
+	}
+
+public:
+	const pdf* p[2];
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,179 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+//progressive rendering in passes over the whole image with checkpoints.
+//Every pass adds samples [pass * spp, (pass + 1) * spp) to each tile and the
+//random sequence of a tile only depends on the seed and the first sample
+//index, so the state to save is just the accumulation buffers and the pass
+//index, and a resumed render adds exactly the same numbers in the same
+//order as an uninterrupted one.
+
+#include "render.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct checkpoint_header {
+	char magic[8];
+	std::int32_t img_width;
+	std::int32_t img_height;
+	std::int32_t max_depth;
+	std::int32_t samples_per_pass;
+	std::int32_t tile_size;
+	std::int32_t pass; //number of finished passes
+	std::uint32_t seed;
+	std::int32_t integrator;
+	std::int32_t sampler;
+};
+
+const char checkpoint_magic[8] = { 'E', 'P', 'T', 'C', 'K', 'P', '2', '\0' };
+
+//write to a temporary file first so that a job killed while saving still
+//leaves the previous checkpoint intact
+bool save_checkpoint(const std::string& path, const checkpoint_header& header, const framebuffer& fb) {
+	auto tmp = path + ".tmp";
+	{
+		std::ofstream out(tmp, std::ios::binary);
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(fb.sum.data()), fb.sum.size() * sizeof(float));
+		out.write(reinterpret_cast<const char*>(fb.count.data()), fb.count.size() * sizeof(int));
+		if (!out)
+			return false;
+	}
+#ifdef _WIN32
+	std::remove(path.c_str());
+#endif
+	return std::rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+//the header has to describe the same render as expected (all but the pass
+//count) and the file has to hold exactly its buffers; nothing is allocated
+//before both are checked
+bool load_checkpoint(const std::string& path, const checkpoint_header& expected, checkpoint_header& header, framebuffer& fb) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| std::memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0)
+		return false;
+	if (header.img_width != expected.img_width || header.img_height != expected.img_height
+		|| header.max_depth != expected.max_depth || header.samples_per_pass != expected.samples_per_pass
+		|| header.tile_size != expected.tile_size || header.seed != expected.seed
+		|| header.integrator != expected.integrator || header.sampler != expected.sampler || header.pass < 0)
+		return false;
+
+	auto pixels = static_cast<std::uint64_t>(header.img_width) * header.img_height;
+	auto payload = pixels * (3 * sizeof(float) + sizeof(int));
+	in.seekg(0, std::ios::end);
+	if (!in || static_cast<std::uint64_t>(in.tellg()) != sizeof(header) + payload)
+		return false;
+	in.seekg(sizeof(header));
+
+	fb = framebuffer(header.img_width, header.img_height);
+	in.read(reinterpret_cast<char*>(fb.sum.data()), fb.sum.size() * sizeof(float));
+	in.read(reinterpret_cast<char*>(fb.count.data()), fb.count.size() * sizeof(int));
+	return static_cast<bool>(in);
+}
+
+//set from a signal handler, a progressive render stops after the current
+//pass and saves a checkpoint
+std::atomic<bool> stop_requested(false);
+
+inline void request_stop(int) {
+	stop_requested = true;
+}
+
+class progressive_renderer {
+public:
+	progressive_renderer(
+		const render_settings& settings,
+		const camera& c,
+		const hittable& w,
+		shared_ptr<hittable> l,
+		int spp_per_pass,
+		int tile
+	) : rs(settings), cam(c), world(w), lights(l), samples_per_pass(spp_per_pass),
+		tile_size(tile), pass(0), fb(settings.img_width, settings.img_height),
+		tiles(make_tiles(settings.img_width, settings.img_height, tile)) {}
+
+	//continue from a checkpoint, which has to come from the same settings
+	bool resume(const std::string& path) {
+		checkpoint_header header;
+		framebuffer loaded;
+		if (!load_checkpoint(path, make_header(), header, loaded))
+			return false;
+		fb = loaded;
+		pass = header.pass;
+		return true;
+	}
+
+	checkpoint_header make_header() const {
+		checkpoint_header header;
+		std::memcpy(header.magic, checkpoint_magic, sizeof(checkpoint_magic));
+		header.img_width = rs.img_width;
+		header.img_height = rs.img_height;
+		header.max_depth = rs.max_depth;
+		header.samples_per_pass = samples_per_pass;
+		header.tile_size = tile_size;
+		header.pass = pass;
+		header.seed = rs.seed;
+		header.integrator = static_cast<std::int32_t>(rs.integrator);
+		header.sampler = static_cast<std::int32_t>(rs.sampler);
+		return header;
+	}
+
+	bool checkpoint(const std::string& path) const {
+		return save_checkpoint(path, make_header(), fb);
+	}
+
+	void render_pass(thread_pool& pool) {
+		auto s0 = pass * samples_per_pass;
+		auto s1 = s0 + samples_per_pass;
+		for (const auto& t : tiles) {
+			pool.submit([this, t, s0, s1] {
+				std::vector<float> buffer(3 * t.pixels());
+				render_tile(t, s0, s1, rs, cam, world, lights, buffer.data());
+				fb.add_tile(t, buffer.data(), samples_per_pass);
+			});
+		}
+		pool.wait();
+		++pass;
+	}
+
+	//render up to the given number of passes, saving a checkpoint every
+	//checkpoint_every passes and when a stop is requested;
+	//returns false if stopped early
+	bool run(thread_pool& pool, int passes, const std::string& checkpoint_path, int checkpoint_every) {
+		while (pass < passes) {
+			std::cerr << "\rPass " << pass + 1 << " of " << passes << ' ' << std::flush;
+			render_pass(pool);
+
+			bool due = checkpoint_every > 0 && pass % checkpoint_every == 0;
+			if (!checkpoint_path.empty() && (due || stop_requested || pass == passes)) {
+				if (!checkpoint(checkpoint_path))
+					std::cerr << "\ncannot write checkpoint " << checkpoint_path << '\n';
+			}
+			if (stop_requested && pass < passes)
+				return false;
+		}
+		return true;
+	}
+
+public:
+	render_settings rs;
+	const camera& cam;
+	const hittable& world;
+	shared_ptr<hittable> lights;
+	int samples_per_pass;
+	int tile_size;
+	int pass;
+	framebuffer fb;
+	std::vector<tile> tiles;
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef QUAD_H
+#define QUAD_H
+
+#include "utils.h"
+#include "hittable.h"
+#include "aarect.h"
+
+//parallelogram with corner Q and edges u, v: points Q + a u + b v with a, b in [0, 1]
+class parallelogram : public hittable {
+public:
+	parallelogram() {}
+	parallelogram(const point3& _Q, const vec3& _u, const vec3& _v, shared_ptr<material> mat)
+		: Q(_Q), u(_u), v(_v), mp(mat) {
+		auto n = cross(u, v);
+		normal = unit_vector(n);
+		D = dot(normal, Q);
+		w = n / dot(n, n);
+		area = n.length();
+	}
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		auto box = surrounding_box(aabb(Q, Q + u + v), aabb(Q + u, Q + v));
+		auto pad = vec3(0.0001, 0.0001, 0.0001);
+		output_box = aabb(box.min() - pad, box.max() + pad);
+		return true;
+	}
+
+	virtual double pdf_value(const point3& o, const vec3& dir) const override {
+		return area_light_pdf(*this, area, o, dir);
+	}
+
+	virtual vec3 random(const point3& o) const override {
+		return Q + random_double() * u + random_double() * v - o;
+	}
+
+	virtual int max_light_group() const override {
+		return mp ? mp->light_group() : -1;
+	}
+
+public:
+	point3 Q;
+	vec3 u, v;
+	shared_ptr<material> mp;
+
+private:
+	vec3 normal;
+	vec3 w;
+	double D;
+	double area;
+};
+
+//infinite plane through p with normal n; it has no bounding box, so keep
+//it next to a bvh_node rather than inside one
+class plane : public hittable {
+public:
+	plane() {}
+	plane(const point3& p, const vec3& n, shared_ptr<material> mat)
+		: normal(unit_vector(n)), D(dot(unit_vector(n), p)), mp(mat) {}
+
+	virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override {
+		auto denom = dot(normal, r.direction());
+		if (fabs(denom) < 1e-12)
+			return false;
+		auto t = (D - dot(normal, r.origin())) / denom;
+		if (t < t_min || t > t_max)
+			return false;
+		rec.t = t;
+		rec.p = r.at(t);
+		rec.u = 0;
+		rec.v = 0;
+		rec.set_face_normal(r, normal);
+		rec.mat_ptr = mp;
+		return true;
+	}
+
+	virtual bool bounding_box(aabb& output_box) const override {
+		return false;
+	}
+
+	virtual int max_light_group() const override {
+		return mp ? mp->light_group() : -1;
+	}
+
+public:
+	vec3 normal;
+	double D;
+	shared_ptr<material> mp;
+};
+
+bool parallelogram::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+	auto denom = dot(normal, r.direction());
+	if (fabs(denom) < 1e-12)
+		return false;
+
+	auto t = (D - dot(normal, r.origin())) / denom;
+	if (t < t_min || t > t_max)
+		return false;
+
+	//planar coordinates of the hit point in the (u, v) frame
+	auto p = r.at(t);
+	auto q = p - Q;
+	auto alpha = dot(w, cross(q, v));
+	auto beta = dot(w, cross(u, q));
+	if (alpha < 0 || alpha > 1 || beta < 0 || beta > 1)
+		return false;
+
+	rec.t = t;
+	rec.p = p;
+	rec.u = alpha;
+	rec.v = beta;
+	rec.set_face_normal(r, normal);
+	rec.mat_ptr = mp;
+	return true;
+}
+
+#endif
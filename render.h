@@ -0,0 +1,276 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "utils.h"
+#include "hittable.h"
+#include "material.h"
+#include "camera.h"
+#include "framebuffer.h"
+
+//how diffuse bounces pick their direction
+enum class integrator_type {
+	bsdf,    //cosine-weighted hemisphere
+	mixture  //half cosine, half towards the lights
+};
+
+//how samples are placed inside a pixel
+enum class sampler_type {
+	random, //independent uniform jitter
+	r2      //per-pixel rotated R2 low-discrepancy sequence
+};
+
+struct render_settings {
+	int img_width;
+	int img_height;
+	int samples_per_pixel;
+	int max_depth;
+	color background;
+	unsigned int seed;
+	int light_groups; //number of per-light buffers, world.max_light_group() + 1; 0 renders only the beauty image
+	integrator_type integrator;
+	sampler_type sampler;
+};
+
+//what a render without options uses
+inline render_settings default_render_settings() {
+	return { 500, 281, 20, 10, color(0, 0, 0), 0, 0, integrator_type::bsdf, sampler_type::random };
+}
+
+//direction and solid angle pdf for a bounce off a diffuse surface;
+//false if the sampled direction has no density
+//density of the directions sample_bounce draws
+inline double bounce_pdf(const hit_record& rec, shared_ptr<hittable> lights, integrator_type integrator, const vec3& direction) {
+	cosine_pdf bsdf_pdf(rec.normal);
+	if (integrator == integrator_type::mixture && lights) {
+		hittable_pdf light_pdf(lights, rec.p);
+		return mixture_pdf(light_pdf, bsdf_pdf).value(direction);
+	}
+	return bsdf_pdf.value(direction);
+}
+
+inline bool sample_bounce(
+	const hit_record& rec,
+	shared_ptr<hittable> lights,
+	integrator_type integrator,
+	ray& scattered,
+	double& pdf_val
+) {
+	cosine_pdf bsdf_pdf(rec.normal);
+	if (integrator == integrator_type::mixture && lights) {
+		hittable_pdf light_pdf(lights, rec.p);
+		mixture_pdf p(light_pdf, bsdf_pdf);
+		scattered = ray(rec.p, p.generate());
+		pdf_val = p.value(scattered.direction());
+	}
+	else {
+		scattered = ray(rec.p, bsdf_pdf.generate());
+		pdf_val = bsdf_pdf.value(scattered.direction());
+	}
+	return pdf_val > 0;
+}
+
+//sub-pixel position of sample s of pixel (i, j)
+inline void pixel_offset(const render_settings& rs, int i, int j, int s, double& du, double& dv) {
+	if (rs.sampler == sampler_type::r2) {
+		//generalized golden ratio sequence, shifted by a per-pixel hash
+		const double a1 = 0.7548776662466927, a2 = 0.5698402909980532;
+		auto h = mix_seed(rs.seed ^ 0x5bd1e995u, j * rs.img_width + i);
+		du = (h & 0xffff) / 65536.0 + s * a1;
+		dv = (h >> 16) / 65536.0 + s * a2;
+		du -= floor(du);
+		dv -= floor(dv);
+		return;
+	}
+	du = random_double();
+	dv = random_double();
+}
+
+color ray_color(
+	const ray& r,
+	const color& background,
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	int depth,
+	integrator_type integrator = integrator_type::bsdf
+) {
+	hit_record rec;
+
+	if (depth <= 0)
+		return color(0, 0, 0);
+
+	if (!world.hit(r, 0.001, infty, rec))
+		return background;
+
+	scatter_record srec;
+	color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+
+	if (!rec.mat_ptr->scatter(r, rec, srec))
+		return emitted;
+
+	if (srec.is_specular) {
+		return srec.attenuation * ray_color(srec.specular_ray, background, world, lights, depth - 1, integrator);
+	}
+
+	ray scattered;
+	double pdf_val;
+	if (!sample_bounce(rec, lights, integrator, scattered, pdf_val))
+		return emitted;
+
+	return emitted + srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered) * ray_color(scattered, background, world, lights, depth - 1, integrator) / pdf_val;
+}
+
+//same estimator as ray_color, but every emitted or background contribution
+//is added, weighted by the path throughput, to the buffer of the light group
+//it came from; the last entry of groups collects the background
+void ray_color_groups(
+	const ray& r,
+	const color& background,
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	int depth,
+	integrator_type integrator,
+	const color& throughput,
+	std::vector<color>& groups
+) {
+	hit_record rec;
+
+	if (depth <= 0)
+		return;
+
+	if (!world.hit(r, 0.001, infty, rec)) {
+		groups.back() += throughput * background;
+		return;
+	}
+
+	scatter_record srec;
+	color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+	if (!emitted.near_zero()) {
+		//groups is sized from world.max_light_group(), so g is in range
+		groups[rec.mat_ptr->light_group()] += throughput * emitted;
+	}
+
+	if (!rec.mat_ptr->scatter(r, rec, srec))
+		return;
+
+	if (srec.is_specular) {
+		ray_color_groups(srec.specular_ray, background, world, lights, depth - 1, integrator, throughput * srec.attenuation, groups);
+		return;
+	}
+
+	ray scattered;
+	double pdf_val;
+	if (!sample_bounce(rec, lights, integrator, scattered, pdf_val))
+		return;
+
+	auto weight = srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered) / pdf_val;
+	ray_color_groups(scattered, background, world, lights, depth - 1, integrator, throughput * weight, groups);
+}
+
+//the random sequence of a tile depends only on the frame seed, the tile
+//position and the first sample index, so any thread or process rendering
+//the same piece of work produces exactly the same numbers
+inline unsigned int tile_seed(const render_settings& rs, const tile& t, int first_sample) {
+	return mix_seed(mix_seed(rs.seed, t.y0 * rs.img_width + t.x0), first_sample);
+}
+
+//the camera rays of samples [s0, s1) of every pixel of the tile, pixel by
+//pixel in the order of the output buffers: sample(r) is called for each ray
+//and pixel_done() after the last sample of a pixel. Seeding and sample
+//placement live only here, so every tile renderer draws the same sequence.
+template <typename sample_fn, typename pixel_fn>
+void trace_tile(
+	const tile& t,
+	int s0,
+	int s1,
+	const render_settings& rs,
+	const camera& cam,
+	sample_fn sample,
+	pixel_fn pixel_done
+) {
+	seed_random(tile_seed(rs, t, s0));
+	for (auto j = t.y0; j < t.y1; ++j) {
+		for (auto i = t.x0; i < t.x1; ++i) {
+			for (auto s = s0; s < s1; ++s) {
+				double du, dv;
+				pixel_offset(rs, i, j, s, du, dv);
+				auto u = (i + du) / (rs.img_width - 1);
+				auto v = (j + dv) / (rs.img_height - 1);
+				sample(cam.get_ray(u, v));
+			}
+			pixel_done();
+		}
+	}
+}
+
+//sums radiance(r) over the samples of every pixel into out, 3 floats per
+//pixel, rows of the tile one after another
+template <typename radiance_fn>
+void render_tile_with(
+	const tile& t,
+	int s0,
+	int s1,
+	const render_settings& rs,
+	const camera& cam,
+	float* out,
+	radiance_fn radiance
+) {
+	color pixel_color(0, 0, 0);
+	trace_tile(t, s0, s1, rs, cam,
+		[&](const ray& r) { pixel_color += radiance(r); },
+		[&] {
+			*out++ = static_cast<float>(pixel_color.x());
+			*out++ = static_cast<float>(pixel_color.y());
+			*out++ = static_cast<float>(pixel_color.z());
+			pixel_color = color(0, 0, 0);
+		});
+}
+
+//accumulate samples [s0, s1) of every pixel of the tile into out,
+//3 floats per pixel, rows of the tile one after another
+void render_tile(
+	const tile& t,
+	int s0,
+	int s1,
+	const render_settings& rs,
+	const camera& cam,
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	float* out
+) {
+	render_tile_with(t, s0, s1, rs, cam, out, [&](const ray& r) {
+		return ray_color(r, rs.background, world, lights, rs.max_depth, rs.integrator);
+	});
+}
+
+//per-light variant of render_tile: out holds light_groups + 1 tile-sized
+//rgb blocks, one per light group followed by one for the background
+void render_tile_groups(
+	const tile& t,
+	int s0,
+	int s1,
+	const render_settings& rs,
+	const camera& cam,
+	const hittable& world,
+	shared_ptr<hittable> lights,
+	float* out
+) {
+	const auto n = rs.light_groups + 1;
+	const auto block = 3 * t.pixels();
+	std::vector<color> groups(n, color(0, 0, 0));
+	auto offset = 0;
+	trace_tile(t, s0, s1, rs, cam,
+		[&](const ray& r) {
+			ray_color_groups(r, rs.background, world, lights, rs.max_depth, rs.integrator, color(1, 1, 1), groups);
+		},
+		[&] {
+			for (auto g = 0; g < n; ++g) {
+				out[g * block + offset + 0] = static_cast<float>(groups[g].x());
+				out[g * block + offset + 1] = static_cast<float>(groups[g].y());
+				out[g * block + offset + 2] = static_cast<float>(groups[g].z());
+			}
+			std::fill(groups.begin(), groups.end(), color(0, 0, 0));
+			offset += 3;
+		});
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+//the renderer as a library: load a scene, set up camera and sampling,
+//render the whole image or a region of it on a caller-owned thread pool
+//and read back the framebuffer. Scenes are immutable once built, so one
+//loaded_scene may be shared by any number of renderers.
+
+#include "render.h"
+#include "scenes.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+class renderer {
+public:
+	renderer(thread_pool& p)
+		: pool(p), rs(default_render_settings()), tile_size(32), fb(rs.img_width, rs.img_height) {
+		auto view = default_view();
+		set_camera(view.lookfrom, view.lookat, view.vfov);
+	}
+
+	void load_scene(const scene_desc& desc) {
+		scene = build_scene(desc);
+	}
+
+	void set_scene(shared_ptr<const loaded_scene> s) {
+		scene = s;
+	}
+
+	void set_camera(const point3& from, const point3& at, double fov) {
+		lookfrom = from;
+		lookat = at;
+		vfov = fov;
+	}
+
+	//also clears the framebuffer
+	void set_image(int width, int height) {
+		rs.img_width = width;
+		rs.img_height = height;
+		fb = framebuffer(width, height);
+	}
+
+	void set_sampling(int spp, int max_depth, integrator_type integrator, sampler_type sampler, unsigned int seed) {
+		rs.samples_per_pixel = spp;
+		rs.max_depth = max_depth;
+		rs.integrator = integrator;
+		rs.sampler = sampler;
+		rs.seed = seed;
+	}
+
+	void set_tile_size(int size) {
+		tile_size = size;
+	}
+
+	//renders the pixels of region, clipped to the image, tile by tile on the
+	//pool. The region is cleared first, so afterwards it holds exactly this
+	//call's samples of the current camera and settings: calling it again
+	//renders the same samples again rather than adding more. Returns false
+	//for a region outside the image or if cancel was set, in which case the
+	//tiles that were not rendered are left empty.
+	bool render_region(const tile& region, const std::atomic<bool>* cancel = nullptr);
+
+	bool render(const std::atomic<bool>* cancel = nullptr) {
+		return render_region({ 0, 0, rs.img_width, rs.img_height }, cancel);
+	}
+
+	const framebuffer& image() const {
+		return fb;
+	}
+
+private:
+	thread_pool& pool;
+	shared_ptr<const loaded_scene> scene;
+	render_settings rs;
+	point3 lookfrom;
+	point3 lookat;
+	double vfov;
+	int tile_size;
+	framebuffer fb;
+};
+
+bool renderer::render_region(const tile& region, const std::atomic<bool>* cancel) {
+	tile clipped = { std::max(region.x0, 0), std::max(region.y0, 0),
+		std::min(region.x1, rs.img_width), std::min(region.y1, rs.img_height) };
+	if (!scene || clipped.width() <= 0 || clipped.height() <= 0)
+		return false;
+	fb.clear_tile(clipped);
+
+	camera cam(lookfrom, lookat, vec3(0, 1, 0), vfov, static_cast<double>(rs.img_width) / rs.img_height);
+	std::vector<tile> tiles;
+	for (const auto& t : make_tiles(clipped.width(), clipped.height(), tile_size))
+		tiles.push_back({ clipped.x0 + t.x0, clipped.y0 + t.y0, clipped.x0 + t.x1, clipped.y0 + t.y1 });
+
+	//the pool may be running other work, so wait for our own tiles only. At
+	//most one tile per pool thread is queued at a time and each finished
+	//tile submits the next, so renders sharing the pool take turns instead
+	//of the later one waiting for all tiles of the earlier one.
+	std::mutex mutex;
+	std::condition_variable finished;
+	size_t remaining = tiles.size();
+	size_t next = std::min(tiles.size(), static_cast<size_t>(std::max(pool.size(), 1)));
+	std::atomic<bool> cancelled(false);
+	auto& s = *scene;
+
+	std::function<void(size_t)> run_tile = [&](size_t k) {
+		const auto& t = tiles[k];
+		if (cancel && *cancel) {
+			cancelled = true;
+		}
+		else {
+			std::vector<float> buffer(3 * t.pixels());
+			render_tile(t, 0, rs.samples_per_pixel, rs, cam, s.world, s.lights, buffer.data());
+			fb.add_tile(t, buffer.data(), rs.samples_per_pixel);
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		if (next < tiles.size()) {
+			auto k_next = next++;
+			pool.submit([&run_tile, k_next] { run_tile(k_next); });
+		}
+		if (--remaining == 0)
+			finished.notify_all();
+	};
+	for (size_t k = 0; k < next; ++k)
+		pool.submit([&run_tile, k] { run_tile(k); });
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [&] { return remaining == 0; });
+	return !cancelled;
+}
+
+#endif
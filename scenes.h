@@ -0,0 +1,111 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "utils.h"
+#include "hittable_list.h"
+#include "sphere.h"
+#include "aarect.h"
+#include "bvh.h"
+#include "material.h"
+
+#include <sstream>
+#include <string>
+
+//walls of the Cornell box
+hittable_list cornell_walls() {
+	hittable_list objects;
+
+	auto material_left = make_shared<lambertian>(color(0.75, 0.25, 0.25));
+	auto material_right = make_shared<lambertian>(color(0.25, 0.25, 0.75));
+	auto material_back = make_shared<lambertian>(color(0.75, 0.75, 0.75));
+	//auto material_front = make_shared<lambertian>(color());
+	auto material_bot = make_shared<lambertian>(color(0.75, 0.75, 0.75));
+	auto material_top = make_shared<lambertian>(color(0.75, 0.75, 0.75));
+
+	//the walls used to be spheres of radius 1e5; the rectangles lie on their
+	//inner surfaces and reach far enough past the open front that rays
+	//leaving the box cannot turn up into the big light sphere
+	const double x0 = 1, x1 = 99, y0 = 0, y1 = 81.6, z0 = 0, z1 = 1000;
+	objects.add(make_shared<yz_rect>(y0, y1, z0, z1, x0, material_left));
+	objects.add(make_shared<yz_rect>(y0, y1, z0, z1, x1, material_right));
+	objects.add(make_shared<xy_rect>(x0, x1, y0, y1, z0, material_back));
+	//objects.add(make_shared<xy_rect>(x0, x1, y0, y1, 170, material_front));
+	objects.add(make_shared<xz_rect>(x0, x1, z0, z1, y0, material_bot));
+	objects.add(make_shared<xz_rect>(x0, x1, z0, z1, y1, material_top));
+	return objects;
+}
+
+//the glass ball followed by the metal ball
+hittable_list cornell_balls() {
+	hittable_list objects;
+
+	auto material_first = make_shared<dielectric>(1.5);
+	auto material_second = make_shared<metal>(color(1, 1, 1), 0.2);
+
+	objects.add(make_shared<sphere>(point3(27, 16.5, 47), 16.5, material_first));
+	objects.add(make_shared<sphere>(point3(73, 16.5, 78), 16.5, material_second));
+	return objects;
+}
+
+//walls and the two balls of the Cornell box, everything except the light
+hittable_list cornell_box() {
+	hittable_list objects = cornell_walls();
+	for (const auto& ball : cornell_balls().objects)
+		objects.add(ball);
+	return objects;
+}
+
+hittable_list simple_scene(const point3& loc, const double& radius, const color& col) {
+	hittable_list objects = cornell_box();
+
+	auto difflight = make_shared<diffuse_light>(col, 0);
+
+	objects.add(make_shared<sphere>(loc, radius, difflight));
+	return hittable_list(make_shared<bvh_node>(objects));
+}
+
+//simple_scene is the Cornell box with a spherical light
+struct scene_desc {
+	point3 light_loc;
+	double light_radius;
+	color light_color;
+
+	//equal keys describe the same scene
+	std::string key() const {
+		std::ostringstream out;
+		out.precision(17);
+		out << light_loc << ' ' << light_radius << ' ' << light_color;
+		return out.str();
+	}
+};
+
+struct loaded_scene {
+	hittable_list world;
+	shared_ptr<hittable> lights;
+};
+
+shared_ptr<const loaded_scene> build_scene(const scene_desc& desc) {
+	auto scene = make_shared<loaded_scene>();
+	scene->world = simple_scene(desc.light_loc, desc.light_radius, desc.light_color);
+	scene->lights = make_shared<sphere>(desc.light_loc, desc.light_radius, shared_ptr<material>());
+	return scene;
+}
+
+//the box under a huge dim light sphere whose lower cap forms the ceiling
+//light; rendered when nothing else is asked for
+inline scene_desc default_scene() {
+	return { point3(50, 681.6 - 0.27, 81.6), 600, color(15, 15, 15) };
+}
+
+struct camera_view {
+	point3 lookfrom;
+	point3 lookat;
+	double vfov;
+};
+
+//looking into the box through its open front
+inline camera_view default_view() {
+	return { point3(50, 50, 295.6), point3(50, 50, 50), 30 };
+}
+
+#endif
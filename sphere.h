@@ -4,6 +4,7 @@
 #include "utils.h"
 #include "hittable.h"
 #include "pdf.h"
+#include "material.h"
 #include "onb.h"
 
 class sphere : public hittable {
@@ -15,8 +16,13 @@ public:
 	virtual bool hit(
 		const ray& r, double t_min, double t_max, hit_record& rec
 	) const override;
+	virtual bool bounding_box(aabb& output_box) const override;
 	virtual double pdf_value(const point3& o, const vec3& v) const override;
 	virtual vec3 random(const point3& o) const override;
+	virtual bool sample_surface(point3& p, vec3& normal, double& area) const override;
+	virtual int max_light_group() const override {
+		return mat_ptr ? mat_ptr->light_group() : -1;
+	}
 
 public:
 	point3 center;
@@ -63,6 +69,13 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
 	return true;
 }
 
+bool sphere::bounding_box(aabb& output_box) const {
+	output_box = aabb(
+		center - vec3(radius, radius, radius),
+		center + vec3(radius, radius, radius));
+	return true;
+}
+
 double sphere::pdf_value(const point3& o, const vec3& v) const {
 	hit_record rec;
 	if (!this->hit(ray(o, v), 0.001, infty, rec))
@@ -82,5 +95,11 @@ vec3 sphere::random(const point3& o) const {
 	return uvw.local(random_to_sphere(radius, distance_squared));
 }
 
+bool sphere::sample_surface(point3& p, vec3& normal, double& area) const {
+	normal = random_unit_vector();
+	p = center + radius * normal;
+	area = 4 * PI * radius * radius;
+	return true;
+}
 
 #endif
@@ -0,0 +1,177 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+//renders many variants of simple_scene in one process: the Cornell box is
+//built once, variants with the same light share their whole scene, and the
+//tiles of all variants go through one thread pool
+
+#include "render.h"
+#include "scenes.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct sweep_variant {
+	point3 light_loc;
+	double light_radius;
+	color light_color;
+	point3 lookfrom;
+	point3 lookat;
+	double vfov;
+	int samples_per_pixel;
+	std::string output;
+};
+
+//one variant per line as key=value pairs, keys that are left out keep the
+//value from defaults; '#' starts a comment:
+//  light=50,681.33,81.6 radius=600 color=15,15,15 lookfrom=50,50,295.6
+//  lookat=50,50,50 vfov=30 spp=20 out=variant.ppm
+bool read_sweep(std::istream& in, const sweep_variant& defaults, std::vector<sweep_variant>& variants) {
+	std::string line;
+	int line_no = 0;
+	while (std::getline(in, line)) {
+		++line_no;
+		auto hash = line.find('#');
+		if (hash != std::string::npos)
+			line.erase(hash);
+
+		std::istringstream tokens(line);
+		std::string token;
+		sweep_variant v = defaults;
+		v.output = "sweep_" + std::to_string(variants.size()) + ".ppm";
+		bool any = false;
+		while (tokens >> token) {
+			any = true;
+			auto eq = token.find('=');
+			auto key = token.substr(0, eq);
+			auto value = eq == std::string::npos ? std::string() : token.substr(eq + 1);
+			bool ok = true;
+			if (key == "light")
+				ok = parse_vec3(value, v.light_loc);
+			else if (key == "radius")
+				ok = (v.light_radius = atof(value.c_str())) > 0;
+			else if (key == "color")
+				ok = parse_vec3(value, v.light_color);
+			else if (key == "lookfrom")
+				ok = parse_vec3(value, v.lookfrom);
+			else if (key == "lookat")
+				ok = parse_vec3(value, v.lookat);
+			else if (key == "vfov")
+				v.vfov = atof(value.c_str());
+			else if (key == "spp")
+				ok = (v.samples_per_pixel = atoi(value.c_str())) > 0;
+			else if (key == "out")
+				v.output = value;
+			else
+				ok = false;
+			if (!ok || value.empty()) {
+				std::cerr << "sweep line " << line_no << ": bad entry '" << token << "'\n";
+				return false;
+			}
+		}
+		if (any)
+			variants.push_back(v);
+	}
+	return true;
+}
+
+void render_sweep(
+	const std::vector<sweep_variant>& variants,
+	const render_settings& base,
+	double asp_ratio,
+	int tile_size,
+	bool correlated,
+	thread_pool& pool
+) {
+	struct shared_scene {
+		point3 loc;
+		double radius;
+		color col;
+		shared_ptr<hittable_list> world;
+		shared_ptr<hittable> lights;
+	};
+
+	struct variant_state {
+		variant_state(const camera& c, const render_settings& r, const shared_scene& s)
+			: cam(c), rs(r), scene(s), fb(r.img_width, r.img_height), remaining(0) {}
+
+		camera cam;
+		render_settings rs;
+		shared_scene scene;
+		framebuffer fb;
+		std::atomic<int> remaining;
+	};
+
+	auto box = make_shared<bvh_node>(cornell_box());
+	std::vector<shared_scene> scenes;
+	std::vector<std::unique_ptr<variant_state>> states;
+	auto tiles = make_tiles(base.img_width, base.img_height, tile_size);
+
+	for (size_t k = 0; k < variants.size(); ++k) {
+		const auto& v = variants[k];
+
+		shared_scene* found = nullptr;
+		for (auto& s : scenes) {
+			if ((s.loc - v.light_loc).near_zero() && s.radius == v.light_radius
+				&& (s.col - v.light_color).near_zero())
+				found = &s;
+		}
+		if (!found) {
+			shared_scene s;
+			s.loc = v.light_loc;
+			s.radius = v.light_radius;
+			s.col = v.light_color;
+			for (const auto& other : scenes) {
+				if ((other.loc - v.light_loc).near_zero() && other.radius == v.light_radius)
+					s.lights = other.lights;
+			}
+			if (!s.lights)
+				s.lights = make_shared<sphere>(s.loc, s.radius, shared_ptr<material>());
+			s.world = make_shared<hittable_list>(box);
+			s.world->add(make_shared<sphere>(s.loc, s.radius, make_shared<diffuse_light>(s.col, 0)));
+			scenes.push_back(s);
+			found = &scenes.back();
+		}
+
+		render_settings rs = base;
+		rs.samples_per_pixel = v.samples_per_pixel;
+		//correlated variants draw the same random numbers for the same tile,
+		//so their differences are not buried in independent noise
+		rs.seed = correlated ? base.seed : mix_seed(base.seed, static_cast<unsigned int>(k + 1));
+
+		camera cam(v.lookfrom, v.lookat, vec3(0, 1, 0), v.vfov, asp_ratio);
+		states.emplace_back(new variant_state(cam, rs, *found));
+		states.back()->remaining = static_cast<int>(tiles.size());
+	}
+
+	std::mutex log_mutex;
+	for (size_t k = 0; k < states.size(); ++k) {
+		for (const auto& t : tiles) {
+			auto state = states[k].get();
+			const auto& output = variants[k].output;
+			pool.submit([state, t, &output, &log_mutex] {
+				std::vector<float> buffer(3 * t.pixels());
+				render_tile(t, 0, state->rs.samples_per_pixel, state->rs, state->cam,
+					*state->scene.world, state->scene.lights, buffer.data());
+				state->fb.add_tile(t, buffer.data(), state->rs.samples_per_pixel);
+
+				if (--state->remaining == 0) {
+					std::ofstream out(output);
+					state->fb.write_ppm(out);
+					std::lock_guard<std::mutex> lock(log_mutex);
+					std::cerr << (out ? "Wrote " : "Cannot write ") << output << '\n';
+				}
+			});
+		}
+	}
+	pool.wait();
+
+	std::cerr << variants.size() << " variants, " << scenes.size() << " distinct scenes\n";
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//fixed set of worker threads running submitted tasks in FIFO order
+class thread_pool {
+public:
+	thread_pool(int n = 0) : busy(0), stopping(false) {
+		if (n <= 0)
+			n = std::max(1u, std::thread::hardware_concurrency());
+		for (auto i = 0; i < n; ++i)
+			threads.emplace_back([this] { work(); });
+	}
+
+	~thread_pool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& t : threads)
+			t.join();
+	}
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	void submit(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+	}
+
+	//block until every submitted task has finished
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return tasks.empty() && busy == 0; });
+	}
+
+	int size() const { return static_cast<int>(threads.size()); }
+
+private:
+	void work() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if (tasks.empty())
+					return;
+				task = std::move(tasks.front());
+				tasks.pop_front();
+				++busy;
+			}
+			task();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				--busy;
+			}
+			idle.notify_all();
+		}
+	}
+
+private:
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	int busy;
+	bool stopping;
+};
+
+#endif
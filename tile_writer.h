@@ -0,0 +1,274 @@
+#ifndef TILE_WRITER_H
+#define TILE_WRITER_H
+
+//streams finished tiles to disk off the render threads. Render threads push
+//tiles into a lock-free queue; one writer thread tonemaps them and writes
+//their rows straight to their place in a preallocated binary PPM, so the
+//image fills in on disk while rendering continues.
+
+#include "utils.h"
+#include "framebuffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+//bounded multi-producer/multi-consumer queue (Vyukov): every cell carries a
+//sequence number telling producers and consumers whose turn it is, so push
+//and pop are a compare-and-swap on a position counter and never lock
+template <typename T>
+class bounded_queue {
+public:
+	bounded_queue(size_t min_capacity) : enqueue_pos(0), dequeue_pos(0) {
+		size_t capacity = 2;
+		while (capacity < min_capacity)
+			capacity *= 2;
+		mask = capacity - 1;
+		cells.reset(new cell[capacity]);
+		for (size_t i = 0; i < capacity; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	//false if the queue is full
+	bool push(T value) {
+		cell* c;
+		auto pos = enqueue_pos.load(std::memory_order_relaxed);
+		while (true) {
+			c = &cells[pos & mask];
+			auto seq = c->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+			if (diff == 0) {
+				if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = enqueue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		c->data = std::move(value);
+		c->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	//false if the queue is empty
+	bool pop(T& value) {
+		cell* c;
+		auto pos = dequeue_pos.load(std::memory_order_relaxed);
+		while (true) {
+			c = &cells[pos & mask];
+			auto seq = c->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+			if (diff == 0) {
+				if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = dequeue_pos.load(std::memory_order_relaxed);
+			}
+		}
+		value = std::move(c->data);
+		c->sequence.store(pos + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	struct cell {
+		std::atomic<size_t> sequence;
+		T data;
+	};
+
+	std::unique_ptr<cell[]> cells;
+	size_t mask;
+	//keep the two counters on separate cache lines
+	char pad0[64];
+	std::atomic<size_t> enqueue_pos;
+	char pad1[64];
+	std::atomic<size_t> dequeue_pos;
+	char pad2[64];
+};
+
+class tile_writer {
+public:
+	struct finished_tile {
+		tile t;
+		int samples;
+		std::vector<float> sum;
+	};
+
+	//max_tiles bounds the tiles in flight; with at least as many as the
+	//image has, pushing never has to wait
+	tile_writer(int w, int h, size_t max_tiles)
+		: width(w), height(h), queue(max_tiles), header_size(0), done(false), io_ok(true) {
+#ifndef _WIN32
+		fd = -1;
+#endif
+	}
+
+	~tile_writer() {
+		finish();
+	}
+
+	//write the header, reserve the whole file (black until tiles arrive)
+	//and start the writer thread
+	bool open(const std::string& path);
+
+	//hand over a tile of rgb sums holding the given samples per pixel;
+	//called from render threads, does no I/O
+	void submit(const tile& t, std::vector<float>&& sum, int samples) {
+		std::unique_ptr<finished_tile> item(new finished_tile{ t, samples, std::move(sum) });
+		while (!queue.push(std::move(item)))
+			std::this_thread::yield();
+	}
+
+	//wait for the queue to drain and close the file; false on I/O errors
+	bool finish();
+
+private:
+	void run();
+	void write_tile(const finished_tile& ft, std::vector<unsigned char>& row);
+	bool write_at(std::uint64_t offset, const void* data, size_t size);
+
+private:
+	int width;
+	int height;
+	bounded_queue<std::unique_ptr<finished_tile>> queue;
+	std::uint64_t header_size;
+	std::thread writer;
+	std::atomic<bool> done;
+	bool io_ok;
+#ifdef _WIN32
+	std::fstream file;
+#else
+	int fd;
+#endif
+};
+
+bool tile_writer::open(const std::string& path) {
+	auto header = "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+	header_size = header.size();
+	std::uint64_t total = header_size + 3ull * width * height;
+
+#ifdef _WIN32
+	file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+	std::vector<char> zeros(3 * width, 0);
+	file.write(header.data(), header.size());
+	for (auto j = 0; j < height; ++j)
+		file.write(zeros.data(), zeros.size());
+	if (!file)
+		return false;
+#else
+	fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+	if (ftruncate(fd, static_cast<off_t>(total)) != 0) {
+		close(fd);
+		fd = -1;
+		return false;
+	}
+	//reserve the blocks up front where the file system supports it
+	posix_fallocate(fd, 0, static_cast<off_t>(total));
+	if (!write_at(0, header.data(), header.size()))
+		return false;
+#endif
+
+	writer = std::thread([this] { run(); });
+	return true;
+}
+
+bool tile_writer::write_at(std::uint64_t offset, const void* data, size_t size) {
+#ifdef _WIN32
+	file.seekp(static_cast<std::streamoff>(offset));
+	file.write(static_cast<const char*>(data), size);
+	return static_cast<bool>(file);
+#else
+	auto p = static_cast<const char*>(data);
+	while (size > 0) {
+		auto n = pwrite(fd, p, size, static_cast<off_t>(offset));
+		if (n <= 0)
+			return false;
+		p += n;
+		offset += n;
+		size -= n;
+	}
+	return true;
+#endif
+}
+
+//same tonemapping as write_color: gamma 2 and clamp
+void tile_writer::write_tile(const finished_tile& ft, std::vector<unsigned char>& row) {
+	const auto& t = ft.t;
+	auto scale = 1.0 / ft.samples;
+	row.resize(3 * t.width());
+	for (auto j = t.y0; j < t.y1; ++j) {
+		const float* src = &ft.sum[3 * (j - t.y0) * t.width()];
+		for (auto i = 0; i < 3 * t.width(); ++i)
+			row[i] = static_cast<unsigned char>(256 * clamp(sqrt(scale * src[i]), 0.0, 0.999));
+
+		//PPM rows run top to bottom, the buffer's from the bottom up
+		auto file_row = height - 1 - j;
+		auto offset = header_size + 3ull * (static_cast<std::uint64_t>(file_row) * width + t.x0);
+		if (!write_at(offset, row.data(), row.size()))
+			io_ok = false;
+	}
+}
+
+void tile_writer::run() {
+	std::vector<unsigned char> row;
+	std::unique_ptr<finished_tile> item;
+	while (true) {
+		if (queue.pop(item)) {
+			write_tile(*item, row);
+			continue;
+		}
+		if (done.load(std::memory_order_acquire)) {
+			//tiles pushed before finish() was called are still drained
+			while (queue.pop(item))
+				write_tile(*item, row);
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+}
+
+bool tile_writer::finish() {
+	if (writer.joinable()) {
+		done.store(true, std::memory_order_release);
+		writer.join();
+	}
+#ifdef _WIN32
+	if (file.is_open()) {
+		file.close();
+		io_ok = io_ok && !file.fail();
+	}
+#else
+	if (fd >= 0) {
+		if (close(fd) != 0)
+			io_ok = false;
+		fd = -1;
+	}
+#endif
+	return io_ok;
+}
+
+#endif
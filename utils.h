@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <limits>
 #include <memory>
+#include <random>
 
 using std::shared_ptr;
 using std::make_shared;
@@ -23,8 +24,30 @@ inline double clamp(double x, double min, double max) {
 	return x;
 }
 
+//per-thread generator, so that tiles rendered on different threads or
+//processes are reproducible from their seed alone
+inline std::mt19937& random_generator() {
+	thread_local std::mt19937 generator;
+	return generator;
+}
+
+inline void seed_random(unsigned int seed) {
+	random_generator().seed(seed);
+}
+
+//combine two values into a well-mixed seed (murmur3 finalizer)
+inline unsigned int mix_seed(unsigned int a, unsigned int b) {
+	unsigned int h = a ^ (b + 0x9e3779b9u + (a << 6) + (a >> 2));
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
 inline double random_double() {
-	return rand() / (RAND_MAX + 1.0);
+	return random_generator()() / (std::mt19937::max() + 1.0);
 }
 
 inline double random_double(double min, double max) {
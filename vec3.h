@@ -14,6 +14,8 @@
 
 #include <cmath>
 #include <iostream>
+#include <sstream>
+#include <string>
 
 using std::sqrt;
 using std::fabs;
@@ -88,6 +90,17 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
+// Parse "x,y,z" as used in sweep and sequence files.
+inline bool parse_vec3(const std::string& s, vec3& v) {
+    double x, y, z;
+    char c1, c2;
+    std::istringstream in(s);
+    if (!(in >> x >> c1 >> y >> c2 >> z) || c1 != ',' || c2 != ',')
+        return false;
+    v = vec3(x, y, z);
+    return true;
+}
+
 inline vec3 operator+(const vec3& u, const vec3& v) {
     return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }